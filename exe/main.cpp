@@ -1,10 +1,57 @@
 #include "ustring.hpp"
+#include "utf8.hpp"
 
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
 
-int main() {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+std::string format_stats(const ustring_stats& stats) {
+    if (!stats.enabled) {
+        return "stats: disabled (build with -DUSTRING_STATS=ON)\n";
+    }
+
+    std::string res;
+    auto line = [&res](const char* name, uint64_t value) {
+        res += name;
+        res += ' ';
+        res += std::to_string(value);
+        res += '\n';
+    };
+    line("validations", stats.validations);
+    line("validated_bytes", stats.validated_bytes);
+    line("length_scans", stats.length_scans);
+    line("scanned_bytes", stats.scanned_bytes);
+    line("index_walks", stats.index_walks);
+    line("index_walk_steps", stats.index_walk_steps);
+    for (size_t i = 0; i < stats.index_walk_histogram.size(); ++i) {
+        if (stats.index_walk_histogram[i] != 0) {
+            size_t from = i == 0 ? 0 : size_t(1) << (i - 1);
+            size_t to = i == 0 ? 1 : 2 * from;
+            res += "index_walks[" + std::to_string(from) + ".." + std::to_string(to) + ") ";
+            res += std::to_string(stats.index_walk_histogram[i]) + "\n";
+        }
+    }
+    line("uchar_allocations", stats.uchar_allocations);
+    line("temporary_ustrings", stats.temporary_ustrings);
+    line("detach_copies", stats.detach_copies);
+    line("detach_bytes", stats.detach_bytes);
+    return res;
+}
+
+int run_interactive() {
     UString ustr;
 
     std::string cmd;
@@ -38,10 +85,331 @@ int main() {
             ustr.pop_back();
         } else if (cmd == "show") {
             std::cout << ustr << "\n";
+        } else if (cmd == "stats") {
+            std::cout << format_stats(UString::stats());
+        } else if (cmd == "exit") {
+            break;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Read-only memory mapping of a whole file. Pipes, FIFOs and other files
+    that cannot be mapped are read into a buffer instead.
+*/
+class mapped_file {
+public:
+    explicit mapped_file(const char* path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("cannot open ") + path + ": " + std::strerror(errno));
+        }
+
+        struct stat st {};
+        if (fstat(fd, &st) < 0) {
+            int err = errno;
+            close(fd);
+            throw std::runtime_error(std::string("cannot stat ") + path + ": " + std::strerror(err));
+        }
+
+        if (!S_ISREG(st.st_mode)) {
+            read_all(fd, path);
+            close(fd);
+            return;
+        }
+
+        m_size = static_cast<size_t>(st.st_size);
+        if (m_size > 0) {
+            void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                int err = errno;
+                close(fd);
+                throw std::runtime_error(std::string("cannot map ") + path + ": " + std::strerror(err));
+            }
+            m_data = static_cast<const char*>(data);
+            madvise(data, m_size, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file() {
+        if (m_data) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+
+    std::string_view view() const noexcept {
+        if (m_data == nullptr) {
+            return m_buffer;
+        }
+        return std::string_view(m_data, m_size);
+    }
+
+private:
+    void read_all(int fd, const char* path) {
+        std::array<char, 1 << 16> chunk;
+        while (true) {
+            ssize_t got = read(fd, chunk.data(), chunk.size());
+            if (got == 0) {
+                break;
+            }
+            if (got < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                int err = errno;
+                close(fd);
+                throw std::runtime_error(std::string("cannot read ") + path + ": " + std::strerror(err));
+            }
+            m_buffer.append(chunk.data(), static_cast<size_t>(got));
+        }
+    }
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    std::string m_buffer;
+};
+
+/*
+    Output buffer flushed with one fwrite per m_capacity bytes.
+*/
+class output_buffer {
+public:
+    explicit output_buffer(FILE* out, size_t capacity = 1 << 20)
+        : m_out(out), m_capacity(capacity) {
+        m_buffer.reserve(capacity);
+    }
+
+    output_buffer(const output_buffer&) = delete;
+    output_buffer& operator=(const output_buffer&) = delete;
+
+    ~output_buffer() {
+        flush();
+    }
+
+    void write(std::string_view data) {
+        if (m_buffer.size() + data.size() > m_capacity) {
+            flush();
+            if (data.size() > m_capacity) {
+                std::fwrite(data.data(), 1, data.size(), m_out);
+                return;
+            }
+        }
+        m_buffer.append(data);
+    }
+
+    void flush() {
+        if (!m_buffer.empty()) {
+            std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_out);
+            m_buffer.clear();
+        }
+        std::fflush(m_out);
+    }
+
+private:
+    FILE* m_out;
+    size_t m_capacity;
+    std::string m_buffer;
+};
+
+/*
+    Whitespace-separated token reader over the mapped script.
+*/
+class token_reader {
+public:
+    explicit token_reader(std::string_view text): m_text(text) {}
+
+    bool next(std::string_view& token) {
+        while (m_pos < m_text.size() && is_space(m_text[m_pos])) {
+            ++m_pos;
+        }
+        if (m_pos == m_text.size()) {
+            return false;
+        }
+        size_t start = m_pos;
+        while (m_pos < m_text.size() && !is_space(m_text[m_pos])) {
+            ++m_pos;
+        }
+        token = m_text.substr(start, m_pos - start);
+        return true;
+    }
+
+    template <typename T>
+    bool next_number(T& value) {
+        std::string_view token;
+        if (!next(token)) {
+            return false;
+        }
+        auto res = std::from_chars(token.data(), token.data() + token.size(), value);
+        return res.ec == std::errc() && res.ptr == token.data() + token.size();
+    }
+
+private:
+    static bool is_space(char symb) {
+        return symb == ' ' || symb == '\n' || symb == '\t' || symb == '\r' || symb == '\v' || symb == '\f';
+    }
+
+    std::string_view m_text;
+    size_t m_pos = 0;
+};
+
+/*
+    Per-command-type call counts and accumulated time.
+*/
+class command_timers {
+public:
+    enum kind { pushc, pushp, pushb, append, pop, show, kinds_num };
+
+    class scope {
+    public:
+        scope(command_timers& timers, kind k)
+            : m_timers(timers), m_kind(k), m_start(std::chrono::steady_clock::now()) {}
+
+        ~scope() {
+            m_timers.m_total[m_kind] += std::chrono::steady_clock::now() - m_start;
+            ++m_timers.m_count[m_kind];
+        }
+
+    private:
+        command_timers& m_timers;
+        kind m_kind;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    void report(FILE* out) const {
+        static constexpr std::array<const char*, kinds_num> names = {
+            "pushc", "pushp", "pushb", "append", "pop", "show"
+        };
+        std::fprintf(out, "%-8s %12s %14s\n", "command", "count", "total_ms");
+        for (size_t i = 0; i < kinds_num; ++i) {
+            double ms = std::chrono::duration<double, std::milli>(m_total[i]).count();
+            std::fprintf(out, "%-8s %12zu %14.3f\n", names[i], m_count[i], ms);
+        }
+    }
+
+private:
+    std::array<std::chrono::steady_clock::duration, kinds_num> m_total{};
+    std::array<size_t, kinds_num> m_count{};
+};
+
+/*
+    Replays a command script. Each push is validated and counted on its
+    own, as in the interactive mode, and then collected into one byte
+    buffer that is appended without another check when the next non-push
+    command or the end of the script is reached.
+*/
+int run_script(const char* path) {
+    mapped_file script(path);
+    token_reader reader(script.view());
+    output_buffer out(stdout);
+    command_timers timers;
+
+    UString ustr;
+    std::string pending;
+    size_t pending_length = 0;
+    auto push_pending = [&pending, &pending_length](std::string_view bytes) {
+        if (!UString::is_well(bytes)) {
+            throw std::invalid_argument("invalid UTF-8 string");
+        }
+        for (size_t i = 0; i < bytes.size(); i += utf8::sequence_len(static_cast<unsigned char>(bytes[i]))) {
+            ++pending_length;
+        }
+        pending.append(bytes);
+    };
+    auto flush_pending = [&]() {
+        if (!pending.empty()) {
+            command_timers::scope timer(timers, command_timers::append);
+            ustr.append_trusted(pending, pending_length);
+            pending.clear();
+            pending_length = 0;
+        }
+    };
+
+    std::string_view cmd;
+    std::string bytes;
+    while (reader.next(cmd)) {
+        if (cmd == "pushc") {
+            command_timers::scope timer(timers, command_timers::pushc);
+            std::string_view symb;
+            if (reader.next(symb)) {
+                push_pending(symb);
+            }
+        } else if (cmd == "pushp") {
+            command_timers::scope timer(timers, command_timers::pushp);
+            unsigned int code = 0;
+            if (!reader.next_number(code) || code > 0x10FFFF) {
+                throw std::invalid_argument("invalid UTF-8 code");
+            }
+            // Like the interactive mode, code 0 adds nothing.
+            if (code != 0) {
+                bytes.clear();
+                utf8::encode(code, bytes);
+                push_pending(bytes);
+            }
+        } else if (cmd == "pushb") {
+            command_timers::scope timer(timers, command_timers::pushb);
+            int bytesNum = 0;
+            if (!reader.next_number(bytesNum) || bytesNum <= 0 || bytesNum > 4) {
+                continue;
+            }
+            bytes.clear();
+            bool terminated = false;
+            for (int i = 0; i < bytesNum; ++i) {
+                unsigned short byte = 0;
+                if (!reader.next_number(byte)) {
+                    throw std::invalid_argument("invalid byte value");
+                }
+                // Like the interactive mode, treat the bytes as a C string.
+                terminated = terminated || static_cast<char>(byte) == 0;
+                if (!terminated) {
+                    bytes.push_back(static_cast<char>(byte));
+                }
+            }
+            push_pending(bytes);
+        } else if (cmd == "pop") {
+            flush_pending();
+            command_timers::scope timer(timers, command_timers::pop);
+            ustr.pop_back();
+        } else if (cmd == "show") {
+            flush_pending();
+            command_timers::scope timer(timers, command_timers::show);
+            out.write(ustr.view());
+            out.write("\n");
+        } else if (cmd == "stats") {
+            flush_pending();
+            out.write(format_stats(UString::stats()));
         } else if (cmd == "exit") {
             break;
         }
     }
+    flush_pending();
 
+    out.flush();
+    timers.report(stderr);
     return EXIT_SUCCESS;
 }
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc == 3 && std::string_view(argv[1]) == "--script") {
+        try {
+            return run_script(argv[2]);
+        } catch (const std::exception& err) {
+            std::fflush(stdout);
+            std::cerr << "ustring: " << err.what() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc != 1) {
+        std::cerr << "usage: " << argv[0] << " [--script FILE]\n";
+        return EXIT_FAILURE;
+    }
+
+    return run_interactive();
+}
@@ -1,5 +1,6 @@
 import argparse
 import subprocess
+import tempfile
 
 exe_path = "ustring"
 
@@ -29,6 +30,54 @@ def test(name, input, expected):
     else:
         print(f"{name}: {message.FAILED} [{repr(expected)} != {repr(output)}]")
 
+def test_script(name, script, expected):
+    with tempfile.NamedTemporaryFile("w", encoding="utf8", suffix=".txt") as file:
+        file.write(script)
+        file.flush()
+        process=subprocess.Popen(
+            [exe_path, "--script", file.name],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            encoding='utf8'
+        )
+        output, _ = process.communicate()
+
+    if output == expected:
+        print(f"{name}: {message.OK}")
+    else:
+        print(f"{name}: {message.FAILED} [{repr(expected)} != {repr(output)}]")
+
+def run(args, input=None):
+    process=subprocess.Popen(
+        [exe_path] + args,
+        stdin=subprocess.PIPE,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        encoding='utf8'
+    )
+    output, _ = process.communicate(input=input)
+    return output, process.returncode == 0
+
+def test_script_stdin(name, script, expected):
+    output, ok = run(["--script", "/dev/stdin"], script)
+
+    if ok and output == expected:
+        print(f"{name}: {message.OK}")
+    else:
+        print(f"{name}: {message.FAILED} [{repr(expected)} != {repr(output)}]")
+
+def test_modes(name, commands):
+    with tempfile.NamedTemporaryFile("w", encoding="utf8", suffix=".txt") as file:
+        file.write(commands)
+        file.flush()
+        script = run(["--script", file.name])
+    interactive = run([], commands)
+
+    if script == interactive:
+        print(f"{name}: {message.OK}")
+    else:
+        print(f"{name}: {message.FAILED} [{repr(interactive)} != {repr(script)}]")
+
 def run_tests():
     test("TestOneChar", "pushc Ю show exit\n", "Ю\n")
     test(
@@ -47,6 +96,20 @@ def run_tests():
     test("TestTwoBytes", f"pushb 2 {0xd0} {0x96} show exit\n", "Ж\n")
     test("TestThreeBytes", f"pushb 3 {0xe3} {0x83} {0x9f} show exit\n", "ミ\n")
     test("TestFourBytes", f"pushb 4 {0xf0} {0x9f} {0xa4} {0x96} show exit\n", "🤖\n")
+
+    test_script(
+        "TestScript",
+        f"pushc Ц pushp 129302 pushb 2 {0xd0} {0x96} show\npop show\npushc 囎 show exit\n",
+        "Ц🤖Ж\nЦ🤖\nЦ🤖囎\n"
+    )
+    test_script("TestScriptNoExit", "pushc パ pushp 84 show", "パT\n")
+
+    test_script_stdin("TestScriptStdin", "pushc Ц pushp 84 show exit\n", "ЦT\n")
+
+    test_modes("TestModesZeroCode", "pushp 0 pushc a show exit\n")
+    test_modes("TestModesNulByte", f"pushb 2 {0x41} 0 pushb 1 {0x42} show exit\n")
+    test_modes("TestModesSplitSequence", f"pushb 1 {0xd0} pushb 1 {0x96} show exit\n")
+    test_modes("TestModesInvalidAfterShow", f"pushc Ж show pushb 1 {0xff} show exit\n")
 if __name__ == "__main__":
     parser = argparse.ArgumentParser()
     parser.add_argument("-p", dest="path", required=True, type=str)
@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 
 #include <ustring.hpp>
+#include <ustring_map.hpp>
+
+#include <unordered_map>
 
 TEST(TestUString, SizeAndLength) {
     UString ustr1 = "aaaaaaaa";
@@ -40,6 +43,17 @@ TEST(TestUString, Concat) {
     ASSERT_TRUE(concat.empty());
 }
 
+TEST(TestUString, AppendTrusted) {
+    UString ustr = "ab";
+    UString shared = ustr;
+    shared.share();
+    shared.append_trusted("私は", 2);
+    ASSERT_EQ(shared, "ab私は");
+    ASSERT_EQ(shared.length(), 4);
+    ASSERT_EQ(shared[3], "は");
+    ASSERT_EQ(ustr, "ab");
+}
+
 TEST(TestUString, Index) {
     UString ustr = "aЮはВ";
     ASSERT_EQ(ustr[0], "a");
@@ -292,6 +306,492 @@ TEST(TestUString, Compare) {
     ASSERT_TRUE(ustr4 != ustr5);
 }
 
+TEST(TestUString, Share) {
+    UString ustr = "スイ誰";
+    ustr.share();
+    ASSERT_TRUE(ustr.is_shared());
+
+    UString copy = ustr;
+    ASSERT_TRUE(copy.is_shared());
+    ASSERT_EQ(copy, ustr);
+
+    copy.push_back(1094);
+    ASSERT_FALSE(copy.is_shared());
+    ASSERT_EQ(copy, "スイ誰ц");
+    ASSERT_EQ(ustr, "スイ誰");
+    ASSERT_EQ(ustr.length(), 3);
+
+    ustr += ustr;
+    ASSERT_EQ(ustr, "スイ誰スイ誰");
+    ASSERT_EQ(ustr.length(), 6);
+
+    UString shared = UString("没关系").share();
+    shared += shared;
+    ASSERT_EQ(shared, "没关系没关系");
+
+    UString moved = std::move(shared.share());
+    ASSERT_TRUE(moved.is_shared());
+    ASSERT_EQ(moved.length(), 6);
+
+    // Unshared strings pay nothing for the shared representation.
+    ASSERT_EQ(sizeof(UString), sizeof(std::string) + sizeof(size_t));
+}
+
+TEST(TestUString, Intern) {
+    UString ustr1 = "没关系";
+    UString ustr2 = std::string("没关系");
+    UString ustr3 = "私は誰ですか";
+
+    UString interned1 = ustr1.intern();
+    UString interned2 = ustr2.intern();
+    UString interned3 = ustr3.intern();
+    ASSERT_TRUE(interned1.is_interned());
+    ASSERT_FALSE(ustr1.is_interned());
+
+    ASSERT_EQ(interned1, interned2);
+    ASSERT_NE(interned1, interned3);
+    ASSERT_EQ(interned1, ustr1);
+    ASSERT_EQ(interned1.length(), 3);
+
+    ASSERT_EQ(*interned2.begin(), "没");
+}
+
+TEST(TestUString, PurgeInterned) {
+    UString::purge_interned();
+
+    UString kept = UString("ключ").intern();
+    {
+        UString temporary = UString("временный").intern();
+        UString copy = temporary;
+    }
+    ASSERT_EQ(UString::purge_interned(), 1);
+    ASSERT_EQ(UString::purge_interned(), 0);
+
+    ASSERT_EQ(kept, "ключ");
+    UString again = UString("ключ").intern();
+    ASSERT_EQ(again.view().data(), kept.view().data());
+}
+
+TEST(TestUString, Hash) {
+    UString ustr1 = "スイ誰";
+    UString ustr2 = std::string("スイ誰");
+    UString ustr3 = "スイ誰a";
+    std::hash<UString> hasher;
+    ASSERT_EQ(hasher(ustr1), hasher(ustr2));
+    ASSERT_NE(hasher(ustr1), hasher(ustr3));
+    ASSERT_EQ(hasher(ustr1), hasher(ustr1.intern()));
+
+    std::unordered_map<UString, int> map;
+    map[ustr1] = 1;
+    map[ustr3] = 2;
+    ASSERT_EQ(map.at(ustr2), 1);
+    ASSERT_EQ(map.size(), 2);
+}
+
+TEST(TestUString, Map) {
+    UStringMap<int> map;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1000; ++i) {
+        keys.push_back("ключ" + std::to_string(i));
+        ASSERT_TRUE(map.try_emplace(keys.back(), i).second);
+    }
+    ASSERT_FALSE(map.try_emplace("ключ5", -1).second);
+    ASSERT_EQ(map.size(), 1000);
+
+    for (int i = 0; i < 1000; ++i) {
+        const int* value = map.find(std::string_view(keys[i]));
+        ASSERT_NE(value, nullptr);
+        ASSERT_EQ(*value, i);
+    }
+    ASSERT_EQ(map.find("ключ1000"), nullptr);
+    ASSERT_EQ(*map.find(UString("ключ7")), 7);
+
+    for (int i = 0; i < 1000; i += 2) {
+        ASSERT_TRUE(map.erase(keys[i]));
+    }
+    ASSERT_FALSE(map.erase("ключ0"));
+    ASSERT_EQ(map.size(), 500);
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(map.contains(keys[i]), i % 2 == 1);
+    }
+
+    map["ключ0"] = 42;
+    ASSERT_EQ(*map.find("ключ0"), 42);
+
+    size_t visited = 0;
+    map.for_each([&visited](const UString&, int) { ++visited; });
+    ASSERT_EQ(visited, 501);
+}
+
+TEST(TestUString, Set) {
+    UStringSet set;
+    ASSERT_TRUE(set.insert("没关系"));
+    ASSERT_FALSE(set.insert(UString("没关系")));
+    ASSERT_TRUE(set.insert("私"));
+    ASSERT_TRUE(set.contains("私"));
+    ASSERT_TRUE(set.contains(std::string_view("没关系")));
+    ASSERT_FALSE(set.contains("没"));
+    ASSERT_TRUE(set.erase("私"));
+    ASSERT_EQ(set.size(), 1);
+}
+
+TEST(TestUString, Casefold) {
+    UString ustr = "Hello, ПРИВЕТ ΣΊΣΥΦΟΣ Ǆ ＡＢＣ";
+    UString folded = ustr.casefold();
+    ASSERT_EQ(folded, "hello, привет σίσυφοσ ǆ ａｂｃ");
+    ASSERT_EQ(folded.length(), ustr.length());
+
+    UString kelvin = "\u212A";
+    ASSERT_EQ(kelvin.casefold(), "k");
+    ASSERT_EQ(kelvin.casefold().length(), 1);
+}
+
+TEST(TestUString, NormalizeNfc) {
+    UString decomposed = "Café 각";
+    UString composed = decomposed.normalize_nfc();
+    ASSERT_EQ(composed, "Café 각");
+    ASSERT_EQ(composed.length(), 6);
+    ASSERT_TRUE(composed.is_nfc());
+    ASSERT_FALSE(decomposed.is_nfc());
+
+    UString ascii = "plain ASCII text, long enough to span several words";
+    ASSERT_TRUE(ascii.is_nfc());
+    ASSERT_EQ(ascii.normalize_nfc(), ascii);
+    ASSERT_TRUE(UString("你好 ́").is_nfc());
+
+    // Composition exclusions stay decomposed.
+    UString excluded = "क़";
+    ASSERT_EQ(excluded.normalize_nfc(), "क़");
+    ASSERT_EQ(excluded.normalize_nfc().length(), 2);
+
+    // A mark of a lower class in between does not block composition.
+    UString unordered = "á̖";
+    ASSERT_FALSE(unordered.is_nfc());
+    ASSERT_EQ(unordered.normalize_nfc(), "á̖");
+}
+
+TEST(TestUString, NormalizeNfd) {
+    UString composed = "résumé 각";
+    UString decomposed = composed.normalize_nfd();
+    ASSERT_EQ(decomposed, "résumé 각");
+    ASSERT_EQ(decomposed.length(), 12);
+    ASSERT_TRUE(decomposed.is_nfd());
+    ASSERT_FALSE(composed.is_nfd());
+    ASSERT_EQ(decomposed.normalize_nfc(), composed);
+
+    // Marks are put into canonical order.
+    UString unordered = "á̖";
+    ASSERT_FALSE(unordered.is_nfd());
+    ASSERT_EQ(unordered.normalize_nfd(), "á̖");
+    ASSERT_EQ(UString("ṩ").normalize_nfd(), "ṩ");
+}
+
+TEST(TestUString, CaseInsensitiveCompare) {
+    ASSERT_TRUE(iequals("Content-Type: TEXT/HTML", "content-type: text/html"));
+    ASSERT_TRUE(iequals("ПРИВЕТ мир", "привет МИР"));
+    ASSERT_TRUE(iequals("ΣΊΣΥΦΟΣ", "σίσυφος"));
+    ASSERT_TRUE(iequals("\u212Aelvin", "kELVIN"));
+    ASSERT_TRUE(iequals("", ""));
+    ASSERT_FALSE(iequals("привет", "привет!"));
+    ASSERT_FALSE(iequals("abcdefghij", "abcdefghik"));
+
+    ASSERT_EQ(icompare("ABCDEFGHIJ", "abcdefghij"), 0);
+    ASSERT_LT(icompare("ABCDEFGHIJ", "abcdefghik"), 0);
+    ASSERT_GT(icompare("Яблоко", "арбуз"), 0);
+    ASSERT_LT(icompare("abc", "ABCD"), 0);
+    ASSERT_GT(icompare("abcd", "ABC"), 0);
+}
+
+TEST(TestUString, GraphemeCount) {
+    ASSERT_EQ(UString("").grapheme_count(), 0);
+    ASSERT_EQ(UString("hello").grapheme_count(), 5);
+    ASSERT_EQ(UString("私は誰ですか").grapheme_count(), 6);
+    ASSERT_EQ(UString("a\r\nb").grapheme_count(), 3);
+
+    UString family = "👨\u200D👩\u200D👧";
+    ASSERT_EQ(family.length(), 5);
+    ASSERT_EQ(family.grapheme_count(), 1);
+
+    UString accent = "e\u0301te\u0301";
+    ASSERT_EQ(accent.length(), 5);
+    ASSERT_EQ(accent.grapheme_count(), 3);
+
+    ASSERT_EQ(UString("🇷🇺🇯🇵").grapheme_count(), 2);
+    ASSERT_EQ(UString("🇷🇺🇯").grapheme_count(), 2);
+    ASSERT_EQ(UString("\u1100\u1161\u11A8\u1100").grapheme_count(), 2);
+    ASSERT_EQ(UString("👍🏽!").grapheme_count(), 2);
+}
+
+TEST(TestUString, GraphemeIterator) {
+    std::array<std::string, 7> clusters = {
+        "a", "e\u0301", "👨\u200D👩\u200D👧", "\r\n", "🇷🇺", "🇯🇵", "ミ"
+    };
+    std::string str = "";
+    for (const auto& cluster: clusters) {
+        str += cluster;
+    }
+    UString ustr = str;
+
+    size_t i = 0;
+    for (auto it = ustr.grapheme_begin(); it != ustr.grapheme_end(); ++it) {
+        ASSERT_EQ(*it, clusters[i]);
+        ++i;
+    }
+    ASSERT_EQ(i, clusters.size());
+
+    auto it = ustr.grapheme_end();
+    while (it != ustr.grapheme_begin()) {
+        --it;
+        --i;
+        ASSERT_EQ(*it, clusters[i]);
+    }
+    ASSERT_EQ(i, 0);
+}
+
+TEST(TestUString, PopBackGrapheme) {
+    UString ustr = "ab👨\u200D👩\u200D👧e\u0301";
+    ustr.pop_back_grapheme();
+    ASSERT_EQ(ustr, "ab👨\u200D👩\u200D👧");
+    ASSERT_EQ(ustr.length(), 7);
+    ustr.pop_back_grapheme();
+    ASSERT_EQ(ustr, "ab");
+    ASSERT_EQ(ustr.length(), 2);
+    ustr.pop_back_grapheme();
+    ustr.pop_back_grapheme();
+    ASSERT_TRUE(ustr.empty());
+    ASSERT_THROW(ustr.pop_back_grapheme(), std::length_error);
+}
+
+TEST(TestUString, DisplayWidth) {
+    ASSERT_EQ(UString("").display_width(), 0);
+    ASSERT_EQ(UString("aaaaaaaa, bbbbbbbb!").display_width(), 19);
+    ASSERT_EQ(UString("私は誰ですか").display_width(), 12);
+    ASSERT_EQ(UString("没关系").display_width(), 6);
+    ASSERT_EQ(UString("Привет").display_width(), 6);
+    ASSERT_EQ(UString("e\u0301").display_width(), 1);
+    ASSERT_EQ(UString("🤖👍").display_width(), 4);
+    ASSERT_EQ(UString("a\tb").display_width(), 2);
+    ASSERT_EQ(UString("ＡＢＣ").display_width(), 6);
+    ASSERT_EQ(UString("👨\u200D👩\u200D👧").display_width(), 2);
+    ASSERT_EQ(UString("x👨\u200D👩\u200D👧y").display_width(), 4);
+    ASSERT_EQ(UString("\u1100\u1161\u11A8").display_width(), 2);
+    ASSERT_EQ(UString("🇷🇺").display_width(), 2);
+    ASSERT_EQ(UString("🇷🇺🇯🇵").display_width(), 4);
+    ASSERT_EQ(UString("\u2764\uFE0F").display_width(), 2);
+    ASSERT_EQ(UString("\u2600\uFE0F!").display_width(), 3);
+}
+
+TEST(TestUString, TruncateToWidth) {
+    UString ascii = "abcdefghijklmnopqrstuvwxyz";
+    ascii.truncate_to_width(10);
+    ASSERT_EQ(ascii, "abcdefghij");
+    ASSERT_EQ(ascii.length(), 10);
+
+    UString cjk = "私は誰ですか";
+    cjk.truncate_to_width(5);
+    ASSERT_EQ(cjk, "私は");
+    ASSERT_EQ(cjk.length(), 2);
+
+    UString accent = "cafe\u0301s";
+    accent.truncate_to_width(4);
+    ASSERT_EQ(accent, "cafe\u0301");
+    ASSERT_EQ(accent.length(), 5);
+
+    UString family = "ab👨\u200D👩\u200D👧c";
+    family.truncate_to_width(4);
+    ASSERT_EQ(family, "ab👨\u200D👩\u200D👧");
+    ASSERT_EQ(family.length(), 7);
+    family.truncate_to_width(3);
+    ASSERT_EQ(family, "ab");
+
+    UString flags = "a🇷🇺🇯🇵";
+    flags.truncate_to_width(4);
+    ASSERT_EQ(flags, "a🇷🇺");
+    ASSERT_EQ(flags.length(), 3);
+
+    UString hearts = "\u2764\uFE0F\u2764\uFE0F";
+    hearts.truncate_to_width(3);
+    ASSERT_EQ(hearts, "\u2764\uFE0F");
+    ASSERT_EQ(hearts.length(), 2);
+
+    UString mixed = "ab没关系";
+    mixed.truncate_to_width(100);
+    ASSERT_EQ(mixed, "ab没关系");
+    mixed.truncate_to_width(0);
+    ASSERT_TRUE(mixed.empty());
+}
+
+TEST(TestUString, Stats) {
+    ustring_stats before = UString::stats();
+    UString ustr = "aЮはВ";
+    ustr.at(3);
+    ustr.push_back(12452);
+    ustring_stats after = UString::stats();
+
+#ifdef USTRING_STATS
+    ASSERT_TRUE(after.enabled);
+    ASSERT_EQ(after.validations - before.validations, 2);
+    ASSERT_EQ(after.validated_bytes - before.validated_bytes, 11);
+    ASSERT_EQ(after.index_walks - before.index_walks, 1);
+    ASSERT_EQ(after.index_walk_steps - before.index_walk_steps, 3);
+    ASSERT_EQ(after.index_walk_histogram[2] - before.index_walk_histogram[2], 1);
+    ASSERT_EQ(after.uchar_allocations - before.uchar_allocations, 2);
+    ASSERT_EQ(after.temporary_ustrings - before.temporary_ustrings, 1);
+#else
+    ASSERT_FALSE(after.enabled);
+    ASSERT_EQ(after.validations, before.validations);
+    ASSERT_EQ(after.index_walks, 0);
+#endif
+}
+
+TEST(TestUString, ParallelConstruction) {
+    std::string str;
+    for (int i = 0; i < 5000; ++i) {
+        str += "aЮは🤖";
+    }
+    for (size_t blocks : {0, 1, 2, 3, 7, 64}) {
+        UString ustr(std::string(str), UString::parallel_policy{blocks});
+        ASSERT_EQ(ustr.size(), str.size());
+        ASSERT_EQ(ustr.length(), 20000);
+    }
+
+    UString moved(std::move(str));
+    ASSERT_EQ(moved.length(), 20000);
+}
+
+TEST(TestUString, ParallelInvalid) {
+    std::string str;
+    for (int i = 0; i < 1000; ++i) {
+        str += "私は誰ですか";
+    }
+    // Break sequences at different offsets, including around block split points.
+    for (size_t pos : {0ul, 1ul, 2ul, str.size() / 2, str.size() / 2 + 1, str.size() - 1}) {
+        std::string broken = str;
+        broken[pos] = static_cast<char>(0xFF);
+        for (size_t blocks : {1, 2, 7}) {
+            ASSERT_THROW(UString(std::string(broken), UString::parallel_policy{blocks}), std::invalid_argument);
+        }
+    }
+
+    std::string truncated = str.substr(0, str.size() / 2 + 1);
+    ASSERT_THROW(UString(std::move(truncated), UString::parallel_policy{2}), std::invalid_argument);
+
+    std::string continuations = "ab" + std::string(4, static_cast<char>(0x80)) + "cd";
+    for (size_t blocks : {1, 2, 3, 4}) {
+        ASSERT_THROW(UString(std::string(continuations), UString::parallel_policy{blocks}), std::invalid_argument);
+    }
+}
+
+TEST(TestUString, Serialize) {
+    UString ustr = "aЮは🤖私は誰ですか没关系";
+    std::string blob;
+    ustr.serialize(blob, UString::serialize_options{true, 3});
+
+    UString loaded = UString::deserialize(blob);
+    ASSERT_EQ(loaded, ustr);
+    ASSERT_EQ(loaded.length(), ustr.length());
+    ASSERT_EQ(UString::deserialize(blob, true), ustr);
+
+    for (size_t i = 0; i < ustr.length(); ++i) {
+        ASSERT_EQ(UString::serialized_at(blob, i), ustr[i]);
+    }
+    ASSERT_THROW(UString::serialized_at(blob, ustr.length()), std::out_of_range);
+
+    std::string ascii_blob;
+    UString("plain ascii").serialize(ascii_blob);
+    ASSERT_EQ(UString::deserialize(ascii_blob), "plain ascii");
+    ASSERT_EQ(UString::serialized_at(ascii_blob, 6), "a");
+
+    std::string empty_blob;
+    UString().serialize(empty_blob);
+    ASSERT_TRUE(UString::deserialize(empty_blob).empty());
+}
+
+TEST(TestUString, DeserializeInvalid) {
+    std::string blob;
+    UString("没关系").serialize(blob);
+
+    ASSERT_THROW(UString::deserialize(blob.substr(0, blob.size() - 1)), std::invalid_argument);
+    ASSERT_THROW(UString::deserialize(""), std::invalid_argument);
+
+    std::string bad_magic = blob;
+    bad_magic[0] = 'X';
+    ASSERT_THROW(UString::deserialize(bad_magic), std::invalid_argument);
+
+    std::string corrupted = blob;
+    corrupted[corrupted.size() - 1] = 'x';
+    ASSERT_THROW(UString::deserialize(corrupted), std::invalid_argument);
+
+    std::string unchecked;
+    UString("没关系").serialize(unchecked, UString::serialize_options{false, 0});
+    unchecked[unchecked.size() - 2] = 'x';
+    ASSERT_THROW(UString::deserialize(unchecked), std::invalid_argument);
+    ASSERT_NO_THROW(UString::deserialize(unchecked, true));
+
+    // Forged ASCII flag: the offsets it implies would split sequences.
+    std::string forged;
+    UString("ЮЮЮ").serialize(forged);
+    forged[5] |= 0x01;
+    ASSERT_THROW(UString::deserialize(forged), std::invalid_argument);
+    ASSERT_THROW(UString::deserialize(forged, true), std::invalid_argument);
+    ASSERT_THROW(UString::serialized_at(forged, 1), std::invalid_argument);
+
+    std::string unknown_flag = blob;
+    unknown_flag[5] |= 0x80;
+    ASSERT_THROW(UString::deserialize(unknown_flag), std::invalid_argument);
+
+    std::string reserved = blob;
+    reserved[6] = 1;
+    ASSERT_THROW(UString::deserialize(reserved), std::invalid_argument);
+}
+
+TEST(TestUString, SerializeBatch) {
+    std::vector<UString> ustrs = { "私は誰ですか", "", "aaaaaaaa", "🤖👍😀💤", "ц" };
+    std::string blob;
+    UString::serialize_batch(ustrs, blob);
+
+    std::vector<UString> loaded = UString::deserialize_batch(blob);
+    ASSERT_EQ(loaded.size(), ustrs.size());
+    for (size_t i = 0; i < ustrs.size(); ++i) {
+        ASSERT_EQ(loaded[i], ustrs[i]);
+        ASSERT_EQ(loaded[i].length(), ustrs[i].length());
+    }
+
+    ASSERT_THROW(UString::deserialize_batch(blob.substr(0, blob.size() - 8)), std::invalid_argument);
+}
+
+TEST(TestUString, FromCharset) {
+    std::string cp1251 = "\xCF\xF0\xE8\xE2\xE5\xF2, world \xB9 \x88";
+    UString ustr = UString::from_charset(cp1251, Charset::Cp1251);
+    ASSERT_EQ(ustr, "Привет, world № €");
+    ASSERT_EQ(ustr.length(), cp1251.size());
+
+    std::string koi8r = "\xF0\xD2\xC9\xD7\xC5\xD4";
+    ASSERT_EQ(UString::from_charset(koi8r, Charset::Koi8r), "Привет");
+
+    std::string latin1 = "caf\xE9 \xFC\xDF";
+    UString latin = UString::from_charset(latin1, Charset::Latin1);
+    ASSERT_EQ(latin, "café üß");
+    ASSERT_EQ(latin.length(), 7);
+
+    ASSERT_TRUE(UString::from_charset("", Charset::Cp1251).empty());
+    ASSERT_THROW(UString::from_charset("\x98", Charset::Cp1251), std::invalid_argument);
+}
+
+TEST(TestUString, ToCharset) {
+    UString ustr = "Привет, world № €";
+    std::string cp1251 = ustr.to_charset(Charset::Cp1251);
+    ASSERT_EQ(cp1251, "\xCF\xF0\xE8\xE2\xE5\xF2, world \xB9 \x88");
+    ASSERT_EQ(UString::from_charset(cp1251, Charset::Cp1251), ustr);
+
+    UString privet = "Привет";
+    ASSERT_EQ(privet.to_charset(Charset::Koi8r), "\xF0\xD2\xC9\xD7\xC5\xD4");
+    ASSERT_EQ(UString("café").to_charset(Charset::Latin1), "caf\xE9");
+
+    ASSERT_THROW(UString("私").to_charset(Charset::Cp1251), std::invalid_argument);
+    ASSERT_THROW(privet.to_charset(Charset::Latin1), std::invalid_argument);
+}
+
 int main(int argc, char* argv[]) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,151 @@
+#!/usr/bin/env perl
+#
+# Generates ustring/unicode_tables.cpp from the Unicode Character Database
+# shipped with Perl (Unicode::UCD).
+#
+# Usage: perl tools/gen_unicode_tables.pl > ustring/unicode_tables.cpp
+#
+# Every property is stored as a two-stage table: stage1 maps the high bits
+# of a codepoint to a block number, stage2 holds the deduplicated blocks.
+
+use strict;
+use warnings;
+
+use Encode ();
+use Unicode::Normalize ();
+use Unicode::UCD qw(prop_invmap prop_invlist charinfo);
+
+my $MAX_CP = 0x110000;
+
+# Expands an inversion map of format 'a' (adjusted) into a per-codepoint
+# delta array: delta = mapping - codepoint.
+sub adjusted_deltas {
+    my ($prop) = @_;
+    my ($list, $map) = prop_invmap($prop);
+    my @deltas = (0) x $MAX_CP;
+    for my $i (0 .. $#$list - 1) {
+        next if $map->[$i] eq '0';
+        for my $cp ($list->[$i] .. $list->[$i + 1] - 1) {
+            $deltas[$cp] = $map->[$i] + ($cp - $list->[$i]) - $cp;
+        }
+    }
+    return \@deltas;
+}
+
+# Expands an enumerated inversion map into a per-codepoint array of
+# numeric ids, given a name => id mapping for every property value.
+sub enumerated_values {
+    my ($prop, $ids) = @_;
+    my ($list, $map) = prop_invmap($prop);
+    my @values = (0) x $MAX_CP;
+    for my $i (0 .. $#$list) {
+        my $end = $i < $#$list ? $list->[$i + 1] : $MAX_CP;
+        die "unknown $prop value $map->[$i]" unless exists $ids->{$map->[$i]};
+        @values[$list->[$i] .. $end - 1] = ($ids->{$map->[$i]}) x ($end - $list->[$i]);
+    }
+    return \@values;
+}
+
+sub emit_array {
+    my ($type, $name, $values) = @_;
+    print "const $type ${name}[] = {\n";
+    for (my $i = 0; $i < @$values; $i += 16) {
+        my $end = $i + 15 < $#$values ? $i + 15 : $#$values;
+        print "    ", join(", ", @$values[$i .. $end]), ",\n";
+    }
+    print "};\n\n";
+}
+
+sub emit_two_stage {
+    my ($name, $type, $shift, $values) = @_;
+    my $block_size = 1 << $shift;
+    my (@stage1, @stage2, %blocks);
+    for (my $start = 0; $start < $MAX_CP; $start += $block_size) {
+        my @block = @$values[$start .. $start + $block_size - 1];
+        my $key = join(",", @block);
+        if (!exists $blocks{$key}) {
+            $blocks{$key} = @stage2 / $block_size;
+            push @stage2, @block;
+        }
+        push @stage1, $blocks{$key};
+    }
+    my $stage1_type = @stage2 / $block_size <= 256 ? "uint8_t" : "uint16_t";
+    emit_array($stage1_type, "${name}_stage1", \@stage1);
+    emit_array($type, "${name}_stage2", \@stage2);
+}
+
+print "// Generated by tools/gen_unicode_tables.pl from Unicode ", Unicode::UCD::UnicodeVersion(), ". Do not edit.\n\n";
+print "#include \"unicode_tables.hpp\"\n\n";
+print "namespace unicode {\n\n";
+
+emit_two_stage("casefold", "int32_t", 7, adjusted_deltas("Simple_Case_Folding"));
+
+# Must match enum class grapheme_break in unicode_tables.hpp.
+my %grapheme_break_ids = (
+    Other => 0, CR => 1, LF => 2, Control => 3, Extend => 4, ZWJ => 5,
+    Regional_Indicator => 6, Prepend => 7, SpacingMark => 8,
+    L => 9, V => 10, T => 11, LV => 12, LVT => 13, ExtPict_XX => 14,
+);
+emit_two_stage("grapheme_break", "uint8_t", 7, enumerated_values("GCB", \%grapheme_break_ids));
+
+# Terminal column width in the spirit of wcwidth(): East_Asian_Width W/F take
+# two columns, nonspacing/enclosing marks, format and control characters and
+# Hangul medial vowels/final consonants and emoji skin tone modifiers take
+# none, everything else takes one.
+my $widths = enumerated_values("East_Asian_Width", { W => 2, F => 2, Na => 1, H => 1, A => 1, Neutral => 1 });
+my $zero_categories = enumerated_values("General_Category", {
+    map({ $_ => 0 } qw(Lu Ll Lt Lm Lo Mc Nd Nl No Pc Pd Ps Pe Pi Pf Po Sm Sc Sk So Zs Zl Zp Cs Co Cn)),
+    map({ $_ => 1 } qw(Mn Me Cf Cc)),
+});
+for my $cp (0 .. $MAX_CP - 1) {
+    $widths->[$cp] = 0 if $zero_categories->[$cp] || ($cp >= 0x1160 && $cp <= 0x11FF);
+}
+$widths->[0xAD] = 1;    # SOFT HYPHEN is rendered
+@$widths[0x1F3FB .. 0x1F3FF] = (0) x 5;    # emoji modifiers merge into the preceding emoji
+emit_two_stage("column_width", "uint8_t", 7, $widths);
+
+# Normalization: canonical combining classes, NFC quick check, full
+# canonical decompositions and primary composites. Hangul syllables are
+# decomposed and composed algorithmically and are left out.
+emit_two_stage("combining_class", "uint8_t", 7,
+               enumerated_values("Canonical_Combining_Class", { map { $_ => $_ } 0 .. 254 }));
+emit_two_stage("nfc_quick_check", "uint8_t", 7, enumerated_values("NFC_Quick_Check", { Yes => 0, N => 1, M => 2 }));
+
+my @decomposition_pool = (0);   # index 0 means no decomposition
+my @decomposition_index = (0) x $MAX_CP;
+my %composites;
+for my $cp (0 .. $MAX_CP - 1) {
+    next if ($cp >= 0xD800 && $cp <= 0xDFFF) || ($cp >= 0xAC00 && $cp <= 0xD7A3);
+    my $canon = Unicode::Normalize::getCanon($cp);
+    next unless defined $canon;
+
+    $decomposition_index[$cp] = scalar @decomposition_pool;
+    push @decomposition_pool, length($canon), map { ord } split //, $canon;
+
+    my $mapping = charinfo($cp)->{decomposition};
+    my @parts = split / /, $mapping;
+    if (@parts == 2 && $mapping !~ /</ && !Unicode::Normalize::isComp_Ex($cp)) {
+        $composites{hex($parts[0]) * 2**21 + hex($parts[1])} = $cp;
+    }
+}
+die "decomposition pool is too large" if @decomposition_pool > 65535;
+emit_two_stage("decomposition", "uint16_t", 7, \@decomposition_index);
+emit_array("uint32_t", "decomposition_pool", \@decomposition_pool);
+
+my @composition_keys = sort { $a <=> $b } keys %composites;
+print "const size_t composition_count = ", scalar(@composition_keys), ";\n\n";
+emit_array("uint64_t", "composition_keys", [map { sprintf("0x%Xull", $_) } @composition_keys]);
+emit_array("uint32_t", "composition_values", [map { $composites{$_} } @composition_keys]);
+
+# Single-byte charsets: codepoints of bytes 0x80..0xFF, 0 for unmapped bytes.
+# Bytes below 0x80 are ASCII in all of them.
+for my $charset (["latin1", "iso-8859-1"], ["cp1251", "cp1251"], ["koi8r", "koi8-r"]) {
+    my ($name, $encoding) = @$charset;
+    my @codes = map {
+        my $char = Encode::decode($encoding, chr($_), sub { "" });
+        length($char) ? ord($char) : 0;
+    } 0x80 .. 0xFF;
+    emit_array("uint16_t", "charset_$name", \@codes);
+}
+
+print "}  // namespace unicode\n";
@@ -0,0 +1,176 @@
+#include "grapheme.hpp"
+#include "unicode_tables.hpp"
+#include "utf8.hpp"
+
+namespace unicode {
+
+namespace {
+
+using gb = grapheme_break;
+
+enum class rule_result {
+    split,
+    join,
+    emoji_zwj,      // GB11: depends on what precedes the ZWJ
+    regional_pair,  // GB12/GB13: depends on the parity of the RI run
+};
+
+bool is_control(gb prop) noexcept {
+    return prop == gb::control || prop == gb::cr || prop == gb::lf;
+}
+
+// Context-free part of the UAX #29 pair table.
+rule_result pair_rule(gb prev, gb next) noexcept {
+    if (prev == gb::cr && next == gb::lf) {
+        return rule_result::join;                                           // GB3
+    }
+    if (is_control(prev) || is_control(next)) {
+        return rule_result::split;                                          // GB4, GB5
+    }
+    if (prev == gb::l && (next == gb::l || next == gb::v || next == gb::lv || next == gb::lvt)) {
+        return rule_result::join;                                           // GB6
+    }
+    if ((prev == gb::lv || prev == gb::v) && (next == gb::v || next == gb::t)) {
+        return rule_result::join;                                           // GB7
+    }
+    if ((prev == gb::lvt || prev == gb::t) && next == gb::t) {
+        return rule_result::join;                                           // GB8
+    }
+    if (next == gb::extend || next == gb::zwj || next == gb::spacing_mark) {
+        return rule_result::join;                                           // GB9, GB9a
+    }
+    if (prev == gb::prepend) {
+        return rule_result::join;                                           // GB9b
+    }
+    if (prev == gb::zwj && next == gb::ext_pict) {
+        return rule_result::emoji_zwj;                                      // GB11
+    }
+    if (prev == gb::regional_indicator && next == gb::regional_indicator) {
+        return rule_result::regional_pair;                                  // GB12, GB13
+    }
+    return rule_result::split;                                              // GB999
+}
+
+bool is_ascii(char byte) noexcept {
+    return (static_cast<unsigned char>(byte) & 0x80) == 0;
+}
+
+}  // namespace
+
+size_t next_grapheme_break(std::string_view str, size_t pos) noexcept {
+    if (pos >= str.size()) {
+        return str.size();
+    }
+
+    // Two ASCII characters never join, except CR LF.
+    if (is_ascii(str[pos]) && str[pos] != '\r' && (pos + 1 == str.size() || is_ascii(str[pos + 1]))) {
+        return pos + 1;
+    }
+
+    size_t len = 0;
+    gb prev = grapheme_break_of(utf8::decode(str.data() + pos, len));
+    pos += len;
+
+    bool after_pict = prev == gb::ext_pict;     // ExtPict Extend* seen so far
+    bool zwj_after_pict = false;                // ... followed by ZWJ
+    size_t regional_run = prev == gb::regional_indicator ? 1 : 0;
+
+    while (pos < str.size()) {
+        gb next = grapheme_break_of(utf8::decode(str.data() + pos, len));
+
+        bool join = false;
+        switch (pair_rule(prev, next)) {
+            case rule_result::join:
+                join = true;
+                break;
+            case rule_result::emoji_zwj:
+                join = zwj_after_pict;
+                break;
+            case rule_result::regional_pair:
+                join = regional_run % 2 == 1;
+                break;
+            case rule_result::split:
+                break;
+        }
+        if (!join) {
+            break;
+        }
+
+        if (next == gb::zwj) {
+            zwj_after_pict = after_pict;
+            after_pict = false;
+        } else if (next != gb::extend) {
+            after_pict = next == gb::ext_pict;
+            zwj_after_pict = false;
+        }
+        regional_run = next == gb::regional_indicator ? regional_run + 1 : 0;
+
+        prev = next;
+        pos += len;
+    }
+
+    return pos;
+}
+
+size_t prev_grapheme_break(std::string_view str, size_t pos) noexcept {
+    if (pos == 0) {
+        return 0;
+    }
+
+    if (is_ascii(str[pos - 1]) && str[pos - 1] != '\n' && (pos == 1 || is_ascii(str[pos - 2]))) {
+        return pos - 1;
+    }
+
+    size_t len = 0;
+    gb next = grapheme_break_of(utf8::decode_back(str.data() + pos, len));
+    pos -= len;
+
+    while (pos > 0) {
+        gb prev = grapheme_break_of(utf8::decode_back(str.data() + pos, len));
+        size_t prev_pos = pos - len;
+
+        bool join = false;
+        switch (pair_rule(prev, next)) {
+            case rule_result::join:
+                join = true;
+                break;
+            case rule_result::emoji_zwj: {
+                // Look behind the ZWJ for ExtPict Extend*.
+                size_t back = prev_pos;
+                gb prop = gb::extend;
+                while (back > 0 && prop == gb::extend) {
+                    prop = grapheme_break_of(utf8::decode_back(str.data() + back, len));
+                    back -= len;
+                }
+                join = prop == gb::ext_pict;
+                break;
+            }
+            case rule_result::regional_pair: {
+                // The pair joins when an odd number of RIs precede next.
+                size_t regional_run = 0;
+                size_t back = pos;
+                while (back > 0) {
+                    if (grapheme_break_of(utf8::decode_back(str.data() + back, len)) != gb::regional_indicator) {
+                        break;
+                    }
+                    back -= len;
+                    ++regional_run;
+                }
+                join = regional_run % 2 == 1;
+                break;
+            }
+            case rule_result::split:
+                break;
+        }
+        if (!join) {
+            break;
+        }
+
+        next = prev;
+        pos = prev_pos;
+    }
+
+    return pos;
+}
+
+}  // namespace unicode
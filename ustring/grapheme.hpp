@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+/*
+    Extended grapheme cluster boundaries (UAX #29) over well-formed UTF-8.
+    Positions are byte offsets that lie on codepoint boundaries.
+*/
+
+namespace unicode {
+
+// End of the grapheme cluster that starts at pos.
+size_t next_grapheme_break(std::string_view str, size_t pos) noexcept;
+
+// Start of the grapheme cluster that ends at pos.
+size_t prev_grapheme_break(std::string_view str, size_t pos) noexcept;
+
+}  // namespace unicode
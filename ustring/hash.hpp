@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/*
+    Byte hash after wyhash (final version):
+    https://github.com/wangyi-fudan/wyhash
+    The main loop consumes 48 bytes per iteration in three independent
+    multiply-mix lanes; short keys are read with a few overlapping loads.
+*/
+
+namespace ustring_hash_detail {
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+constexpr uint64_t secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+inline void mum(uint64_t& a, uint64_t& b) noexcept {
+    uint128_t r = a;
+    r *= b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b) noexcept {
+    mum(a, b);
+    return a ^ b;
+}
+
+inline uint64_t read8(const unsigned char* p) noexcept {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t read4(const unsigned char* p) noexcept {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint64_t read3(const unsigned char* p, size_t k) noexcept {
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+}  // namespace ustring_hash_detail
+
+inline uint64_t ustring_hash_bytes(const char* data, size_t size, uint64_t seed = 0) noexcept {
+    using namespace ustring_hash_detail;
+
+    auto p = reinterpret_cast<const unsigned char*>(data);
+    seed ^= mix(seed ^ secret[0], secret[1]);
+
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (size <= 16) {
+        if (size >= 4) {
+            a = (read4(p) << 32) | read4(p + ((size >> 3) << 2));
+            b = (read4(p + size - 4) << 32) | read4(p + size - 4 - ((size >> 3) << 2));
+        } else if (size > 0) {
+            a = read3(p, size);
+        }
+    } else {
+        size_t i = size;
+        if (i > 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do {
+                seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ secret[2], read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ secret[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    mum(a, b);
+    return mix(a ^ secret[0] ^ size, b ^ secret[1]);
+}
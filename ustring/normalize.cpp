@@ -0,0 +1,213 @@
+#include "normalize.hpp"
+#include "unicode_tables.hpp"
+#include "utf8.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace unicode {
+
+namespace {
+
+// Hangul syllable composition constants, The Unicode Standard, section 3.12.
+constexpr unsigned int s_base = 0xAC00;
+constexpr unsigned int l_base = 0x1100;
+constexpr unsigned int v_base = 0x1161;
+constexpr unsigned int t_base = 0x11A7;
+constexpr unsigned int l_count = 19;
+constexpr unsigned int v_count = 21;
+constexpr unsigned int t_count = 28;
+constexpr unsigned int s_count = l_count * v_count * t_count;
+
+bool is_hangul_syllable(unsigned int code) noexcept {
+    return code - s_base < s_count;
+}
+
+quick_check check(unsigned int code, normal_form form) noexcept {
+    if (form == normal_form::nfc) {
+        return nfc_quick_check(code);
+    }
+    bool decomposable = is_hangul_syllable(code) || canonical_decomposition(code) != nullptr;
+    return decomposable ? quick_check::no : quick_check::yes;
+}
+
+struct scan_state {
+    quick_check result = quick_check::yes;
+    size_t safe_pos = 0;        // normalization may restart from here
+    size_t safe_count = 0;      // codepoints before safe_pos
+};
+
+/*
+    Quick check pass. Walks while the text is known to be normalized and
+    remembers the last starter that cannot interact with anything before
+    it: a codepoint with combining class 0 and quick check Yes. Everything
+    before that point is already in the normal form.
+*/
+scan_state scan(std::string_view str, normal_form form) noexcept {
+    scan_state state;
+    size_t pos = 0;
+    size_t count = 0;
+    unsigned int last_ccc = 0;
+    while (pos < str.size()) {
+        size_t run = utf8::ascii_run(str.data() + pos, str.size() - pos);
+        if (run > 0) {
+            pos += run;
+            count += run;
+            state.safe_pos = pos - 1;
+            state.safe_count = count - 1;
+            last_ccc = 0;
+            continue;
+        }
+
+        size_t len = 0;
+        unsigned int code = utf8::decode(str.data() + pos, len);
+        unsigned int ccc = combining_class(code);
+        if (ccc != 0 && last_ccc > ccc) {
+            state.result = quick_check::no;
+            return state;
+        }
+        quick_check qc = check(code, form);
+        if (qc != quick_check::yes) {
+            state.result = qc;
+            return state;
+        }
+        if (ccc == 0) {
+            state.safe_pos = pos;
+            state.safe_count = count;
+        }
+        last_ccc = ccc;
+        pos += len;
+        ++count;
+    }
+
+    state.safe_pos = pos;
+    state.safe_count = count;
+    return state;
+}
+
+// Appends code keeping the trailing run of non-starters in canonical order.
+void push_ordered(std::vector<uint32_t>& cps, unsigned int code) {
+    cps.push_back(code);
+    unsigned int ccc = combining_class(code);
+    if (ccc == 0) {
+        return;
+    }
+    for (size_t i = cps.size() - 1; i > 0 && combining_class(cps[i - 1]) > ccc; --i) {
+        std::swap(cps[i - 1], cps[i]);
+    }
+}
+
+void push_decomposed(std::vector<uint32_t>& cps, unsigned int code) {
+    if (is_hangul_syllable(code)) {
+        unsigned int s_index = code - s_base;
+        cps.push_back(l_base + s_index / (v_count * t_count));
+        cps.push_back(v_base + (s_index % (v_count * t_count)) / t_count);
+        if (s_index % t_count != 0) {
+            cps.push_back(t_base + s_index % t_count);
+        }
+        return;
+    }
+
+    const uint32_t* decomposition = canonical_decomposition(code);
+    if (decomposition == nullptr) {
+        push_ordered(cps, code);
+        return;
+    }
+    for (uint32_t i = 1; i <= decomposition[0]; ++i) {
+        push_ordered(cps, decomposition[i]);
+    }
+}
+
+// Primary composite of the pair, 0 if there is none.
+unsigned int compose_pair(unsigned int first, unsigned int second) noexcept {
+    if (first - l_base < l_count && second - v_base < v_count) {
+        return s_base + ((first - l_base) * v_count + (second - v_base)) * t_count;
+    }
+    if (is_hangul_syllable(first) && (first - s_base) % t_count == 0 && second - (t_base + 1) < t_count - 1) {
+        return first + (second - t_base);
+    }
+
+    uint64_t key = (static_cast<uint64_t>(first) << 21) | second;
+    const uint64_t* end = composition_keys + composition_count;
+    const uint64_t* it = std::lower_bound(composition_keys, end, key);
+    return it != end && *it == key ? composition_values[it - composition_keys] : 0;
+}
+
+// Canonical composition of a decomposed, canonically ordered sequence, in place.
+void compose(std::vector<uint32_t>& cps) {
+    constexpr size_t npos = static_cast<size_t>(-1);
+
+    size_t starter = npos;
+    unsigned int last_ccc = 0;
+    size_t out = 0;
+    for (size_t i = 0; i < cps.size(); ++i) {
+        unsigned int code = cps[i];
+        unsigned int ccc = combining_class(code);
+        if (starter != npos) {
+            bool adjacent = out - 1 == starter;
+            bool blocked = !adjacent && (last_ccc == 0 || last_ccc >= ccc);
+            if (!blocked) {
+                unsigned int composite = compose_pair(cps[starter], code);
+                if (composite != 0) {
+                    cps[starter] = composite;
+                    continue;
+                }
+            }
+        }
+        if (ccc == 0) {
+            starter = out;
+        }
+        last_ccc = ccc;
+        cps[out++] = code;
+    }
+    cps.resize(out);
+}
+
+}  // namespace
+
+size_t normalize(std::string_view str, normal_form form, std::string& out) {
+    scan_state state = scan(str, form);
+    if (state.result == quick_check::yes) {
+        out.append(str);
+        return state.safe_count;
+    }
+
+    out.reserve(out.size() + str.size());
+    out.append(str.data(), state.safe_pos);
+
+    std::vector<uint32_t> cps;
+    cps.reserve(str.size() - state.safe_pos);
+    for (size_t pos = state.safe_pos; pos < str.size();) {
+        size_t run = utf8::ascii_run(str.data() + pos, str.size() - pos);
+        cps.insert(cps.end(), str.begin() + pos, str.begin() + pos + run);
+        pos += run;
+        if (pos < str.size()) {
+            size_t len = 0;
+            push_decomposed(cps, utf8::decode(str.data() + pos, len));
+            pos += len;
+        }
+    }
+
+    if (form == normal_form::nfc) {
+        compose(cps);
+    }
+    for (uint32_t code : cps) {
+        utf8::encode(code, out);
+    }
+    return state.safe_count + cps.size();
+}
+
+bool is_normalized(std::string_view str, normal_form form) {
+    scan_state state = scan(str, form);
+    if (state.result != quick_check::maybe) {
+        return state.result == quick_check::yes;
+    }
+
+    std::string normalized;
+    normalize(str, form, normalized);
+    return normalized == str;
+}
+
+}  // namespace unicode
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/*
+    Canonical Unicode normalization (UAX #15) over well-formed UTF-8.
+*/
+
+namespace unicode {
+
+enum class normal_form {
+    nfc,
+    nfd,
+};
+
+// Appends the normalized form of str to out and returns its codepoint count.
+size_t normalize(std::string_view str, normal_form form, std::string& out);
+
+bool is_normalized(std::string_view str, normal_form form);
+
+}  // namespace unicode
@@ -0,0 +1,118 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace ustring_stats_detail {
+
+namespace {
+
+/*
+    Only the owning thread writes its counters, so increments are a relaxed
+    load and store rather than a locked read-modify-write. Atomics keep the
+    concurrent reads made by snapshot() well-defined.
+*/
+struct thread_counters {
+    std::array<std::atomic<uint64_t>, counters_num> values{};
+    std::array<std::atomic<uint64_t>, ustring_stats::histogram_size> index_walks{};
+};
+
+void bump(std::atomic<uint64_t>& counter, uint64_t value) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+struct registry {
+    std::mutex mutex;
+    std::vector<const thread_counters*> live;
+    std::array<uint64_t, counters_num> retired_values{};
+    std::array<uint64_t, ustring_stats::histogram_size> retired_index_walks{};
+};
+
+registry& get_registry() {
+    static registry* reg = new registry();  // outlives thread_local destructors
+    return *reg;
+}
+
+struct thread_slot {
+    thread_counters counters;
+
+    thread_slot() {
+        registry& reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.live.push_back(&counters);
+    }
+
+    ~thread_slot() {
+        registry& reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (size_t i = 0; i < counters_num; ++i) {
+            reg.retired_values[i] += counters.values[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < ustring_stats::histogram_size; ++i) {
+            reg.retired_index_walks[i] += counters.index_walks[i].load(std::memory_order_relaxed);
+        }
+        reg.live.erase(std::find(reg.live.begin(), reg.live.end(), &counters));
+    }
+};
+
+thread_counters& local() {
+    thread_local thread_slot slot;
+    return slot.counters;
+}
+
+}  // namespace
+
+void add(counter id, uint64_t value) noexcept {
+    bump(local().values[id], value);
+}
+
+void record_index_walk(size_t steps) noexcept {
+    size_t bucket = 0;
+    for (size_t rest = steps; rest > 0 && bucket + 1 < ustring_stats::histogram_size; rest >>= 1) {
+        ++bucket;
+    }
+    thread_counters& counters = local();
+    bump(counters.values[index_walks], 1);
+    bump(counters.values[index_walk_steps], steps);
+    bump(counters.index_walks[bucket], 1);
+}
+
+ustring_stats snapshot() {
+    std::array<uint64_t, counters_num> values{};
+    std::array<uint64_t, ustring_stats::histogram_size> walks{};
+    {
+        registry& reg = get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        values = reg.retired_values;
+        walks = reg.retired_index_walks;
+        for (const thread_counters* counters : reg.live) {
+            for (size_t i = 0; i < counters_num; ++i) {
+                values[i] += counters->values[i].load(std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < ustring_stats::histogram_size; ++i) {
+                walks[i] += counters->index_walks[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    ustring_stats res;
+#ifdef USTRING_STATS
+    res.enabled = true;
+#endif
+    res.validations = values[validations];
+    res.validated_bytes = values[validated_bytes];
+    res.length_scans = values[length_scans];
+    res.scanned_bytes = values[scanned_bytes];
+    res.index_walks = values[index_walks];
+    res.index_walk_steps = values[index_walk_steps];
+    res.index_walk_histogram = walks;
+    res.uchar_allocations = values[uchar_allocations];
+    res.temporary_ustrings = values[temporary_ustrings];
+    res.detach_copies = values[detach_copies];
+    res.detach_bytes = values[detach_bytes];
+    return res;
+}
+
+}  // namespace ustring_stats_detail
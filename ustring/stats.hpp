@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+/*
+    Hot-path instrumentation counters, compiled in only with USTRING_STATS
+    (cmake -DUSTRING_STATS=ON). Without it the USTRING_STAT_* macros expand
+    to nothing and their arguments are not evaluated.
+
+    Every thread increments its own counters; a snapshot sums the counters
+    of all live threads and of the threads that have already exited.
+    Counters only grow, so the cost of a code section is the difference of
+    two snapshots.
+*/
+
+struct ustring_stats {
+    // Bucket i counts walks of [2^(i-1), 2^i) steps, bucket 0 counts empty walks.
+    static constexpr size_t histogram_size = 24;
+
+    bool enabled = false;
+
+    uint64_t validations = 0;           // is_well() passes
+    uint64_t validated_bytes = 0;
+    uint64_t length_scans = 0;          // codepoint counting passes
+    uint64_t scanned_bytes = 0;
+    uint64_t index_walks = 0;           // linear codepoint index lookups
+    uint64_t index_walk_steps = 0;
+    std::array<uint64_t, histogram_size> index_walk_histogram{};
+    uint64_t uchar_allocations = 0;     // uchar results of at(), [], *it, push_back(code)
+    uint64_t temporary_ustrings = 0;    // UString temporaries made by push_back(uchar)
+    uint64_t detach_copies = 0;         // copy-on-write buffer copies
+    uint64_t detach_bytes = 0;
+};
+
+namespace ustring_stats_detail {
+
+enum counter {
+    validations,
+    validated_bytes,
+    length_scans,
+    scanned_bytes,
+    index_walks,
+    index_walk_steps,
+    uchar_allocations,
+    temporary_ustrings,
+    detach_copies,
+    detach_bytes,
+    counters_num,
+};
+
+void add(counter id, uint64_t value) noexcept;
+void record_index_walk(size_t steps) noexcept;
+ustring_stats snapshot();
+
+}  // namespace ustring_stats_detail
+
+#ifdef USTRING_STATS
+#define USTRING_STAT_ADD(id, value) ::ustring_stats_detail::add(::ustring_stats_detail::id, (value))
+#define USTRING_STAT_INDEX_WALK(steps) ::ustring_stats_detail::record_index_walk(steps)
+#else
+#define USTRING_STAT_ADD(id, value) ((void)0)
+#define USTRING_STAT_INDEX_WALK(steps) ((void)0)
+#endif
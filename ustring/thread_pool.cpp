@@ -0,0 +1,119 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+namespace {
+
+// Enough for a memory-bound scan; more workers only add idle threads.
+constexpr size_t max_workers = 8;
+
+/*
+    Blocks until pred holds. The deadline is unbounded, so this is a plain
+    blocking wait without periodic wakeups; it is spelled as wait_until()
+    because the steady_clock overload is header-only in libstdc++, while
+    condition_variable::wait() got a new symbol version in GCC 12 and would
+    tie the binary to the newest runtime (see ustring/CMakeLists.txt).
+*/
+template <typename Predicate>
+void wait_until_ready(std::condition_variable& cond, std::unique_lock<std::mutex>& lock, Predicate pred) {
+    cond.wait_until(lock, std::chrono::steady_clock::time_point::max(), pred);
+}
+
+}  // namespace
+
+thread_pool::thread_pool(size_t workers) {
+    m_workers.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        m_workers.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+thread_pool& thread_pool::instance() {
+    static thread_pool pool(std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u) - 1, max_workers));
+    return pool;
+}
+
+size_t thread_pool::concurrency() const noexcept {
+    return m_workers.size() + 1;
+}
+
+void thread_pool::parallel_for(size_t tasks, const std::function<void(size_t)>& func) {
+    /*
+        Helpers that only get scheduled after all tasks are taken find the
+        counter exhausted and return, so the job state is shared with them
+        rather than borrowed from this frame.
+    */
+    struct job {
+        std::function<void(size_t)> func;
+        size_t tasks = 0;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> remaining{0};
+        std::mutex mutex;
+        std::condition_variable done;
+
+        void work() {
+            for (size_t i = next++; i < tasks; i = next++) {
+                func(i);
+                if (--remaining == 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done.notify_all();
+                }
+            }
+        }
+    };
+
+    if (tasks == 0) {
+        return;
+    }
+
+    auto state = std::make_shared<job>();
+    state->func = func;
+    state->tasks = tasks;
+    state->remaining = tasks;
+
+    size_t helpers = std::min(m_workers.size(), tasks - 1);
+    if (helpers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t i = 0; i < helpers; ++i) {
+                m_queue.emplace_back([state]() { state->work(); });
+            }
+        }
+        m_wake.notify_all();
+    }
+
+    state->work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    wait_until_ready(state->done, lock, [&state]() { return state->remaining == 0; });
+}
+
+void thread_pool::worker_loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            wait_until_ready(m_wake, lock, [this]() { return m_stop || !m_queue.empty(); });
+            if (m_stop && m_queue.empty()) {
+                return;
+            }
+            task = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    Fixed set of worker threads reused across calls. parallel_for() hands
+    out task indices through an atomic counter; the calling thread takes
+    part in the work too, so a pool without workers runs everything inline.
+*/
+class thread_pool {
+public:
+    explicit thread_pool(size_t workers);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // Process-wide pool with one worker per additional hardware thread, at most 8.
+    static thread_pool& instance();
+
+    size_t concurrency() const noexcept;
+
+    // Calls func(i) for every i in [0, tasks) and waits for all of them.
+    // func must not throw.
+    void parallel_for(size_t tasks, const std::function<void(size_t)>& func);
+
+private:
+    void worker_loop();
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<std::function<void()>> m_queue;
+    bool m_stop = false;
+};
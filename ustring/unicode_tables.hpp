@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Unicode property lookups backed by two-stage tables generated with
+    tools/gen_unicode_tables.pl. Codepoints are expected to be <= 0x10FFFF.
+*/
+
+namespace unicode {
+
+extern const uint8_t casefold_stage1[];
+extern const int32_t casefold_stage2[];
+
+constexpr unsigned int casefold_shift = 7;
+
+inline unsigned int simple_casefold(unsigned int code) noexcept {
+    unsigned int block = casefold_stage1[code >> casefold_shift];
+    unsigned int offset = code & ((1u << casefold_shift) - 1);
+    return code + casefold_stage2[(block << casefold_shift) | offset];
+}
+
+enum class grapheme_break : uint8_t {
+    other,
+    cr,
+    lf,
+    control,
+    extend,
+    zwj,
+    regional_indicator,
+    prepend,
+    spacing_mark,
+    l,
+    v,
+    t,
+    lv,
+    lvt,
+    ext_pict,
+};
+
+extern const uint8_t grapheme_break_stage1[];
+extern const uint8_t grapheme_break_stage2[];
+
+constexpr unsigned int grapheme_break_shift = 7;
+
+inline grapheme_break grapheme_break_of(unsigned int code) noexcept {
+    unsigned int block = grapheme_break_stage1[code >> grapheme_break_shift];
+    unsigned int offset = code & ((1u << grapheme_break_shift) - 1);
+    return static_cast<grapheme_break>(grapheme_break_stage2[(block << grapheme_break_shift) | offset]);
+}
+
+extern const uint8_t column_width_stage1[];
+extern const uint8_t column_width_stage2[];
+
+constexpr unsigned int column_width_shift = 7;
+
+// Number of terminal columns (0, 1 or 2) the codepoint occupies.
+inline unsigned int column_width(unsigned int code) noexcept {
+    unsigned int block = column_width_stage1[code >> column_width_shift];
+    unsigned int offset = code & ((1u << column_width_shift) - 1);
+    return column_width_stage2[(block << column_width_shift) | offset];
+}
+
+extern const uint8_t combining_class_stage1[];
+extern const uint8_t combining_class_stage2[];
+extern const uint8_t nfc_quick_check_stage1[];
+extern const uint8_t nfc_quick_check_stage2[];
+extern const uint8_t decomposition_stage1[];
+extern const uint16_t decomposition_stage2[];
+extern const uint32_t decomposition_pool[];
+extern const size_t composition_count;
+extern const uint64_t composition_keys[];
+extern const uint32_t composition_values[];
+
+constexpr unsigned int normalization_shift = 7;
+
+enum class quick_check : uint8_t {
+    yes,
+    no,
+    maybe,
+};
+
+inline unsigned int combining_class(unsigned int code) noexcept {
+    unsigned int block = combining_class_stage1[code >> normalization_shift];
+    unsigned int offset = code & ((1u << normalization_shift) - 1);
+    return combining_class_stage2[(block << normalization_shift) | offset];
+}
+
+inline quick_check nfc_quick_check(unsigned int code) noexcept {
+    unsigned int block = nfc_quick_check_stage1[code >> normalization_shift];
+    unsigned int offset = code & ((1u << normalization_shift) - 1);
+    return static_cast<quick_check>(nfc_quick_check_stage2[(block << normalization_shift) | offset]);
+}
+
+// Full canonical decomposition of a non-Hangul codepoint: a pointer to
+// {length, codepoints...} in decomposition_pool, or nullptr if there is none.
+inline const uint32_t* canonical_decomposition(unsigned int code) noexcept {
+    unsigned int block = decomposition_stage1[code >> normalization_shift];
+    unsigned int offset = code & ((1u << normalization_shift) - 1);
+    unsigned int idx = decomposition_stage2[(block << normalization_shift) | offset];
+    return idx == 0 ? nullptr : decomposition_pool + idx;
+}
+
+// Codepoints of the bytes 0x80..0xFF of single-byte charsets, 0 if unmapped.
+extern const uint16_t charset_latin1[];
+extern const uint16_t charset_cp1251[];
+extern const uint16_t charset_koi8r[];
+
+}  // namespace unicode
@@ -1,13 +1,24 @@
 #include "ustring.hpp"
+#include "grapheme.hpp"
+#include "normalize.hpp"
+#include "thread_pool.hpp"
+#include "unicode_tables.hpp"
+#include "utf8.hpp"
 
+#include <algorithm>
 #include <array>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
 
 /*
     UString iterator
 */
 
 UString::iterator::iterator(const UString& ustr)
-    : m_ustring(ustr.m_ustring), m_length(ustr.length()) {}
+    : m_ustring(&ustr.bytes()), m_length(ustr.length()) {}
 
 UString::iterator::iterator(const iterator& it)
     : m_ustring(it.m_ustring), m_idx(it.m_idx), m_length(it.m_length) {}
@@ -23,8 +34,9 @@ UString::iterator::reference UString::iterator::operator*() const {
     if (m_idx >= m_length) {
         throw std::out_of_range("index value is greater than the length of the string");
     }
-    size_t pos = get_codepoint_pos(m_idx, m_ustring);
-    return m_ustring.substr(pos, get_codepoint_len(pos, m_ustring));
+    USTRING_STAT_ADD(uchar_allocations, 1);
+    size_t pos = get_codepoint_pos(m_idx, *m_ustring);
+    return m_ustring->substr(pos, get_codepoint_len(pos, *m_ustring));
 }
 
 UString::iterator::pointer UString::iterator::operator->() const {
@@ -94,60 +106,132 @@ UString::iterator UString::iterator::operator-(size_t n) const {
 }
 
 
+/*
+    UString grapheme iterator
+*/
+
+UString::grapheme_iterator::grapheme_iterator(const ustring_t& ustring, size_t pos)
+    : m_ustring(&ustring), m_pos(pos), m_next(unicode::next_grapheme_break(ustring, pos)) {}
+
+UString::grapheme_iterator::reference UString::grapheme_iterator::operator*() const {
+    if (m_pos >= m_ustring->size()) {
+        throw std::out_of_range("grapheme iterator is not dereferenceable");
+    }
+    return std::string_view(*m_ustring).substr(m_pos, m_next - m_pos);
+}
+
+UString::grapheme_iterator& UString::grapheme_iterator::operator++() {
+    m_pos = m_next;
+    m_next = unicode::next_grapheme_break(*m_ustring, m_pos);
+    return *this;
+}
+
+UString::grapheme_iterator UString::grapheme_iterator::operator++(int) {
+    grapheme_iterator tmp = *this;
+    ++(*this);
+    return tmp;
+}
+
+UString::grapheme_iterator& UString::grapheme_iterator::operator--() {
+    m_next = m_pos;
+    m_pos = unicode::prev_grapheme_break(*m_ustring, m_pos);
+    return *this;
+}
+
+UString::grapheme_iterator UString::grapheme_iterator::operator--(int) {
+    grapheme_iterator tmp = *this;
+    --(*this);
+    return tmp;
+}
+
+bool UString::grapheme_iterator::operator==(const grapheme_iterator& it) const {
+    return m_ustring == it.m_ustring && m_pos == it.m_pos;
+}
+
+bool UString::grapheme_iterator::operator!=(const grapheme_iterator& it) const {
+    return !(*this == it);
+}
+
+
 /*
     UString
 */
 
+UString::UString() noexcept: m_ustring(), m_length(0), m_is_shared(0) {}
+
 UString::UString(const char* cstr): UString(std::string(cstr)) {}
 
-UString::UString(const std::string& str): m_ustring(str) {
-    if (!is_well()) {
-        throw std::invalid_argument("invalid UTF-8 string");
+UString::UString(const std::string& str): UString(std::string(str)) {}
+
+UString::UString(std::string&& str): m_ustring(std::move(str)), m_length(0), m_is_shared(0) {
+    init_length(m_ustring.size() >= parallel_threshold, 0);
+}
+
+UString::UString(std::string&& str, parallel_policy policy)
+    : m_ustring(std::move(str)), m_length(0), m_is_shared(0) {
+    init_length(true, policy.blocks);
+}
+
+UString::UString(const UString& other): m_length(other.m_length), m_is_shared(other.m_is_shared) {
+    if (m_is_shared) {
+        m_shared = other.m_shared;
+        m_shared->acquire();
+    } else {
+        new (&m_ustring) ustring_t(other.m_ustring);
     }
-    m_length = calc_length();
 }
 
-UString::UString(const UString& other)
-    : m_ustring(other.m_ustring), m_length(other.m_length) {}
+UString::UString(UString&& other) noexcept {
+    steal(other);
+}
 
-UString::UString(UString&& other) noexcept
-    : m_ustring(std::move(other.m_ustring)), m_length(std::move(other.m_length)) {}
+UString::~UString() {
+    destroy();
+}
 
 UString& UString::operator=(const char* str) {
     return (*this = std::string(str));
 }
 
 UString& UString::operator=(const std::string& str) {
-    ustring_t old = m_ustring;
-    m_ustring = str;
-    if (!is_well()) {
-        m_ustring = old;
-        throw std::invalid_argument("invalid UTF-8 string");
-    }
-    m_length = calc_length();
-    return *this;
+    UString tmp(str);
+    return (*this = std::move(tmp));
+}
+
+UString& UString::operator=(std::string&& str) {
+    UString tmp(std::move(str));
+    return (*this = std::move(tmp));
 }
 
 UString& UString::operator=(const UString& other) {
-    m_ustring = other.m_ustring;
-    m_length = other.m_length;
-    return *this;
+    if (!m_is_shared && !other.m_is_shared) {
+        m_ustring = other.m_ustring;
+        m_length = other.m_length;
+        return *this;
+    }
+    UString tmp(other);
+    return (*this = std::move(tmp));
 }
 
 UString& UString::operator=(UString&& other) noexcept {
-    m_ustring = std::move(other.m_ustring);
-    m_length = std::move(other.m_length);
+    if (this != &other) {
+        destroy();
+        steal(other);
+    }
     return *this;
 }
 
 UString& UString::operator+=(const std::string& str) {
-    ustring_t old = m_ustring;
-    m_ustring += str;
-    if (!is_well()) {
-        m_ustring = old;
+    /*
+        Appending well-formed UTF-8 to well-formed UTF-8 keeps it well-formed,
+        so only the appended part is validated and counted.
+    */
+    if (!is_well(str)) {
         throw std::invalid_argument("invalid UTF-8 string");
     }
-    m_length = calc_length();
+    detach();
+    m_ustring += str;
+    m_length += calc_length(str);
     return *this;
 }
 
@@ -156,13 +240,30 @@ UString& UString::operator+=(const char* cstr) {
 }
 
 UString& UString::operator+=(const UString& other) {
-    m_ustring += other.m_ustring;
+    // Holds the buffer other shares (maybe with *this) while detaching from it.
+    UString keep_alive = other.m_is_shared ? UString(other) : UString();
+    const ustring_t& other_bytes = other.bytes();
+    detach();
+    m_ustring += other_bytes;
     m_length += other.m_length;
     return *this;
 }
 
+UString& UString::append_trusted(std::string_view str, size_t length) {
+    detach();
+    m_ustring += str;
+    m_length += length;
+    return *this;
+}
+
 void UString::clear() noexcept {
-    m_ustring.clear();
+    if (m_is_shared) {
+        m_shared->release();
+        new (&m_ustring) ustring_t();
+        m_is_shared = 0;
+    } else {
+        m_ustring.clear();
+    }
     m_length = 0;
 }
 
@@ -171,14 +272,20 @@ bool UString::empty() const noexcept {
 }
 
 bool UString::is_well() const {
+    return is_well(bytes());
+}
+
+bool UString::is_well(std::string_view str) {
+    USTRING_STAT_ADD(validations, 1);
+    USTRING_STAT_ADD(validated_bytes, str.size());
+
     /*
         According to the table from:
         https://lemire.me/blog/2018/05/09/how-quickly-can-you-check-that-a-string-is-valid-unicode-utf-8/
     */
 
-    auto bytes = std::basic_string<unsigned char>(m_ustring.cbegin(), m_ustring.cend());
-    auto it = bytes.cbegin();
-    auto end = bytes.cend(); 
+    auto it = reinterpret_cast<const unsigned char*>(str.data());
+    auto end = it + str.size();
     while (it != end) {
         if ((0xF8 & *it) == 0xF0 && *it <= 0xF4) {
             if (it + 1 == end || it + 2 == end || it + 3 == end) {
@@ -240,32 +347,589 @@ bool UString::is_well() const {
     return true;
 }
 
+UString& UString::share() {
+    if (!m_is_shared) {
+        adopt(new shared_rep{std::move(m_ustring)});
+    }
+    return *this;
+}
+
+void UString::shared_rep::acquire() noexcept {
+    refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void UString::shared_rep::release() noexcept {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+namespace {
+
+/*
+    Interning pool split into independently locked shards, so concurrent
+    intern() calls on different strings rarely contend for the same mutex.
+    Keys are views into the immutable pooled buffers. The pool holds one
+    reference to every buffer; purge() drops the buffers nobody else holds.
+*/
+template <typename Rep>
+class intern_pool {
+public:
+    intern_pool() = default;
+    intern_pool(const intern_pool&) = delete;
+    intern_pool& operator=(const intern_pool&) = delete;
+
+    ~intern_pool() {
+        for (shard& sh : m_shards) {
+            for (auto& entry : sh.reps) {
+                entry.second->release();
+            }
+        }
+    }
+
+    // Returns the pooled buffer for key with a reference taken for the caller.
+    template <typename Factory>
+    Rep* get(std::string_view key, Factory make_rep) {
+        shard& sh = m_shards[ustring_hash_bytes(key.data(), key.size()) % shards_num];
+        std::lock_guard<std::mutex> lock(sh.mutex);
+        auto it = sh.reps.find(key);
+        if (it != sh.reps.end()) {
+            it->second->acquire();
+            return it->second;
+        }
+        std::unique_ptr<Rep> rep(make_rep());
+        sh.reps.emplace(std::string_view(rep->ustring), rep.get());
+        rep->acquire();
+        return rep.release();
+    }
+
+    /*
+        A buffer whose only reference is the pool's cannot gain a new one
+        meanwhile: no UString holds it, and get() takes the shard lock.
+    */
+    size_t purge() {
+        size_t released = 0;
+        for (shard& sh : m_shards) {
+            std::lock_guard<std::mutex> lock(sh.mutex);
+            for (auto it = sh.reps.begin(); it != sh.reps.end();) {
+                Rep* rep = it->second;
+                if (rep->refs.load(std::memory_order_acquire) == 1) {
+                    it = sh.reps.erase(it);
+                    rep->release();
+                    ++released;
+                } else {
+                    ++it;
+                }
+            }
+        }
+        return released;
+    }
+
+private:
+    static constexpr size_t shards_num = 16;
+
+    struct view_hash {
+        size_t operator()(std::string_view key) const noexcept {
+            return ustring_hash_bytes(key.data(), key.size(), shards_num);
+        }
+    };
+
+    struct shard {
+        std::mutex mutex;
+        std::unordered_map<std::string_view, Rep*, view_hash> reps;
+    };
+
+    std::array<shard, shards_num> m_shards;
+};
+
+template <typename Rep>
+intern_pool<Rep>& interned_pool() {
+    static intern_pool<Rep> pool;
+    return pool;
+}
+
+}  // namespace
+
+UString UString::intern() const {
+    if (is_interned()) {
+        return *this;
+    }
+
+    const ustring_t& str = bytes();
+    UString res;
+    res.adopt(interned_pool<shared_rep>().get(str, [&str]() {
+        return new shared_rep{str, true};
+    }));
+    res.m_length = m_length;
+    return res;
+}
+
+size_t UString::purge_interned() {
+    return interned_pool<shared_rep>().purge();
+}
+
+ustring_stats UString::stats() {
+    return ustring_stats_detail::snapshot();
+}
+
+/*
+    Serialization
+
+    All integers are little-endian. A serialized string is
+
+        0   magic "USTR"
+        4   u8  version
+        5   u8  flags (flag_ascii | flag_checksum)
+        6   u16 reserved, 0
+        8   u64 byte size
+        16  u64 codepoint count
+        24  u64 wyhash of the bytes, 0 without flag_checksum
+        32  u32 checkpoint interval in codepoints, 0 without checkpoints
+        36  u32 checkpoints number
+        40  u64 byte offset of codepoint (i + 1) * interval, per checkpoint
+        ..  bytes
+
+    A batch is the magic "USTB", u32 version, u64 strings number and then
+    the serialized strings, each padded with zeros to a multiple of 8 bytes.
+*/
+
+namespace {
+
+constexpr uint8_t serial_version = 1;
+constexpr size_t serial_header_size = 40;
+constexpr size_t batch_header_size = 16;
+
+constexpr uint8_t flag_ascii = 0x01;
+constexpr uint8_t flag_checksum = 0x02;
+constexpr uint8_t known_flags = flag_ascii | flag_checksum;
+
+void put_le(std::string& out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+uint64_t get_le(std::string_view in, size_t pos, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(in[pos + i])) << (8 * i);
+    }
+    return value;
+}
+
+[[noreturn]] void throw_invalid_blob() {
+    throw std::invalid_argument("invalid serialized UString");
+}
+
+struct serial_header {
+    uint8_t flags = 0;
+    uint64_t byte_size = 0;
+    uint64_t length = 0;
+    uint64_t checksum = 0;
+    uint64_t checkpoint_interval = 0;
+    uint64_t checkpoints_num = 0;
+
+    size_t checkpoints_pos() const {
+        return serial_header_size;
+    }
+
+    size_t bytes_pos() const {
+        return serial_header_size + 8 * checkpoints_num;
+    }
+
+    size_t total_size() const {
+        return bytes_pos() + byte_size;
+    }
+};
+
+/*
+    O(1) structural check: magic, version, flags and reserved field, that
+    the ASCII flag agrees with the stored sizes and that every part fits
+    into blob.
+*/
+serial_header parse_header(std::string_view blob) {
+    if (blob.size() < serial_header_size || blob.substr(0, 4) != "USTR" ||
+        get_le(blob, 4, 1) != serial_version || (get_le(blob, 5, 1) & ~known_flags) != 0 ||
+        get_le(blob, 6, 2) != 0) {
+        throw_invalid_blob();
+    }
+
+    serial_header header;
+    header.flags = static_cast<uint8_t>(get_le(blob, 5, 1));
+    header.byte_size = get_le(blob, 8, 8);
+    header.length = get_le(blob, 16, 8);
+    header.checksum = get_le(blob, 24, 8);
+    header.checkpoint_interval = get_le(blob, 32, 4);
+    header.checkpoints_num = get_le(blob, 36, 4);
+
+    size_t available = blob.size() - serial_header_size;
+    if (header.checkpoints_num > available / 8 || header.byte_size > available - 8 * header.checkpoints_num ||
+        header.length > header.byte_size || (header.checkpoints_num > 0 && header.checkpoint_interval == 0) ||
+        ((header.flags & flag_ascii) && header.length != header.byte_size)) {
+        throw_invalid_blob();
+    }
+    return header;
+}
+
+}  // namespace
+
+void UString::serialize(std::string& out) const {
+    serialize(out, serialize_options());
+}
+
+void UString::serialize(std::string& out, serialize_options options) const {
+    const ustring_t& str = bytes();
+    size_t interval = options.checkpoint_interval;
+    if (interval > UINT32_MAX) {
+        throw std::invalid_argument("checkpoint interval is too large");
+    }
+    size_t checkpoints_num = interval == 0 || m_length == 0 ? 0 : (m_length - 1) / interval;
+    if (checkpoints_num > UINT32_MAX) {
+        throw std::invalid_argument("checkpoint interval is too small");
+    }
+
+    uint8_t flags = 0;
+    if (m_length == str.size()) {
+        flags |= flag_ascii;
+    }
+    if (options.checksum) {
+        flags |= flag_checksum;
+    }
+
+    out.reserve(out.size() + serial_header_size + 8 * checkpoints_num + str.size());
+    out.append("USTR", 4);
+    put_le(out, serial_version, 1);
+    put_le(out, flags, 1);
+    put_le(out, 0, 2);
+    put_le(out, str.size(), 8);
+    put_le(out, m_length, 8);
+    put_le(out, options.checksum ? ustring_hash_bytes(str.data(), str.size()) : 0, 8);
+    put_le(out, interval, 4);
+    put_le(out, checkpoints_num, 4);
+
+    if (checkpoints_num > 0) {
+        size_t pos = 0;
+        size_t idx = 0;
+        for (size_t i = 1; i <= checkpoints_num; ++i) {
+            if (flags & flag_ascii) {
+                pos = i * interval;
+            } else {
+                for (; idx < i * interval; ++idx) {
+                    pos += get_codepoint_len(pos);
+                }
+            }
+            put_le(out, pos, 8);
+        }
+    }
+
+    out.append(str);
+}
+
+UString UString::deserialize(std::string_view blob, bool trusted) {
+    /*
+        A trusted blob is only checked structurally; otherwise the checksum,
+        the UTF-8 well-formedness and the stored length are verified too.
+    */
+    serial_header header = parse_header(blob);
+    std::string_view str = blob.substr(header.bytes_pos(), header.byte_size);
+
+    if (!trusted) {
+        if ((header.flags & flag_checksum) && ustring_hash_bytes(str.data(), str.size()) != header.checksum) {
+            throw_invalid_blob();
+        }
+        if (!is_well(str)) {
+            throw std::invalid_argument("invalid UTF-8 string");
+        }
+        if (calc_length(str) != header.length) {
+            throw_invalid_blob();
+        }
+    }
+
+    UString res;
+    res.m_ustring.assign(str.data(), str.size());
+    res.m_length = header.length;
+    return res;
+}
+
+UString::uchar UString::serialized_at(std::string_view blob, size_t index) {
+    serial_header header = parse_header(blob);
+    if (index >= header.length) {
+        throw std::out_of_range("index value is greater than the length of the string");
+    }
+    std::string_view str = blob.substr(header.bytes_pos(), header.byte_size);
+    if (header.flags & flag_ascii) {
+        return uchar(1, str[index]);
+    }
+
+    size_t pos = 0;
+    size_t skip = index;
+    size_t checkpoint = header.checkpoint_interval == 0 ? 0 : index / header.checkpoint_interval;
+    if (checkpoint > 0 && checkpoint <= header.checkpoints_num) {
+        pos = get_le(blob, header.checkpoints_pos() + 8 * (checkpoint - 1), 8);
+        skip = index - checkpoint * header.checkpoint_interval;
+    }
+    for (; skip > 0 && pos < str.size(); --skip) {
+        pos += utf8::sequence_len(static_cast<unsigned char>(str[pos]));
+    }
+    if (pos >= str.size()) {
+        throw_invalid_blob();
+    }
+    size_t len = std::min(utf8::sequence_len(static_cast<unsigned char>(str[pos])), str.size() - pos);
+    return uchar(str.substr(pos, len));
+}
+
+void UString::serialize_batch(const std::vector<UString>& ustrs, std::string& out) {
+    serialize_batch(ustrs, out, serialize_options());
+}
+
+void UString::serialize_batch(const std::vector<UString>& ustrs, std::string& out,
+                              serialize_options options) {
+    size_t total = batch_header_size;
+    for (const auto& ustr : ustrs) {
+        total += serial_header_size + ustr.size() + 8 + 8 * (options.checkpoint_interval == 0 ? 0 :
+                 ustr.length() / options.checkpoint_interval);
+    }
+    out.reserve(out.size() + total);
+
+    size_t start = out.size();
+    out.append("USTB", 4);
+    put_le(out, serial_version, 4);
+    put_le(out, ustrs.size(), 8);
+    for (const auto& ustr : ustrs) {
+        ustr.serialize(out, options);
+        out.append((8 - (out.size() - start) % 8) % 8, '\0');
+    }
+}
+
+std::vector<UString> UString::deserialize_batch(std::string_view blob, bool trusted) {
+    if (blob.size() < batch_header_size || blob.substr(0, 4) != "USTB" ||
+        get_le(blob, 4, 4) != serial_version) {
+        throw_invalid_blob();
+    }
+    uint64_t count = get_le(blob, 8, 8);
+    if (count > (blob.size() - batch_header_size) / serial_header_size) {
+        throw_invalid_blob();
+    }
+
+    std::vector<UString> res;
+    res.reserve(count);
+    size_t pos = batch_header_size;
+    for (uint64_t i = 0; i < count; ++i) {
+        std::string_view rest = blob.substr(std::min(pos, blob.size()));
+        serial_header header = parse_header(rest);
+        res.push_back(deserialize(rest.substr(0, header.total_size()), trusted));
+        pos += (header.total_size() + 7) / 8 * 8;
+    }
+    return res;
+}
+
+bool UString::is_shared() const noexcept {
+    return m_is_shared;
+}
+
+bool UString::is_interned() const noexcept {
+    return m_is_shared && m_shared->interned;
+}
+
 size_t UString::size() const noexcept {
-    return m_ustring.size();
+    return bytes().size();
 }
 
 size_t UString::length() const noexcept {
     return m_length;
 }
 
+std::string_view UString::view() const noexcept {
+    return bytes();
+}
+
+namespace {
+
+const uint16_t* charset_table(Charset charset) {
+    switch (charset) {
+        case Charset::Latin1:
+            return unicode::charset_latin1;
+        case Charset::Cp1251:
+            return unicode::charset_cp1251;
+        case Charset::Koi8r:
+            return unicode::charset_koi8r;
+    }
+    throw std::invalid_argument("unknown charset");
+}
+
+// (codepoint, byte) pairs of a charset's upper half, sorted by codepoint.
+using charset_reverse_t = std::vector<std::pair<uint16_t, unsigned char>>;
+
+const charset_reverse_t& charset_reverse_table(Charset charset) {
+    static const std::array<charset_reverse_t, 3> tables = []() {
+        std::array<charset_reverse_t, 3> res;
+        for (Charset cs : { Charset::Latin1, Charset::Cp1251, Charset::Koi8r }) {
+            const uint16_t* table = charset_table(cs);
+            auto& reverse = res[static_cast<size_t>(cs)];
+            for (size_t i = 0; i < 128; ++i) {
+                if (table[i] != 0) {
+                    reverse.emplace_back(table[i], static_cast<unsigned char>(0x80 + i));
+                }
+            }
+            std::sort(reverse.begin(), reverse.end());
+        }
+        return res;
+    }();
+    if (static_cast<size_t>(charset) >= tables.size()) {
+        throw std::invalid_argument("unknown charset");
+    }
+    return tables[static_cast<size_t>(charset)];
+}
+
+size_t charset_utf8_len(uint16_t code) noexcept {
+    return code < 0x80 ? 1 : code < 0x800 ? 2 : 3;
+}
+
+}  // namespace
+
+UString UString::from_charset(std::string_view bytes, Charset charset) {
+    /*
+        Every input byte is exactly one codepoint, and the table only holds
+        valid scalar values, so the result needs neither validation nor a
+        length scan. A first pass sizes the buffer exactly.
+    */
+    const uint16_t* table = charset_table(charset);
+
+    size_t out_size = 0;
+    for (size_t pos = 0; pos < bytes.size();) {
+        size_t run = utf8::ascii_run(bytes.data() + pos, bytes.size() - pos);
+        out_size += run;
+        pos += run;
+        if (pos < bytes.size()) {
+            uint16_t code = table[static_cast<unsigned char>(bytes[pos]) - 0x80];
+            if (code == 0) {
+                throw std::invalid_argument("byte is not mapped in the charset");
+            }
+            out_size += charset_utf8_len(code);
+            ++pos;
+        }
+    }
+
+    UString res;
+    res.m_ustring.reserve(out_size);
+    for (size_t pos = 0; pos < bytes.size();) {
+        size_t run = utf8::ascii_run(bytes.data() + pos, bytes.size() - pos);
+        res.m_ustring.append(bytes.data() + pos, run);
+        pos += run;
+        if (pos < bytes.size()) {
+            utf8::encode(table[static_cast<unsigned char>(bytes[pos]) - 0x80], res.m_ustring);
+            ++pos;
+        }
+    }
+    res.m_length = bytes.size();
+    return res;
+}
+
+std::string UString::to_charset(Charset charset) const {
+    const charset_reverse_t& reverse = charset_reverse_table(charset);
+    const ustring_t& str = bytes();
+
+    std::string res;
+    res.reserve(m_length);
+    for (size_t pos = 0; pos < str.size();) {
+        size_t run = utf8::ascii_run(str.data() + pos, str.size() - pos);
+        res.append(str, pos, run);
+        pos += run;
+        if (pos < str.size()) {
+            size_t len = 0;
+            unsigned int code = utf8::decode(str.data() + pos, len);
+            auto it = std::lower_bound(reverse.begin(), reverse.end(), std::make_pair(code, 0u),
+                [](const auto& entry, const auto& key) { return entry.first < key.first; });
+            if (it == reverse.end() || it->first != code) {
+                throw std::invalid_argument("character is not representable in the charset");
+            }
+            res.push_back(static_cast<char>(it->second));
+            pos += len;
+        }
+    }
+    return res;
+}
+
+UString UString::casefold() const {
+    const ustring_t& str = bytes();
+    UString res;
+    res.m_ustring.reserve(str.size());
+
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t run = utf8::ascii_run(str.data() + pos, str.size() - pos);
+        if (run > 0) {
+            size_t out = res.m_ustring.size();
+            res.m_ustring.append(str, pos, run);
+            char* dst = &res.m_ustring[out];
+            size_t i = 0;
+            for (; i + 8 <= run; i += 8) {
+                utf8::store8(dst + i, utf8::ascii_tolower8(utf8::load8(dst + i)));
+            }
+            for (; i < run; ++i) {
+                dst[i] = static_cast<char>(utf8::ascii_tolower(static_cast<unsigned char>(dst[i])));
+            }
+            pos += run;
+        }
+
+        if (pos < str.size()) {
+            size_t len = 0;
+            unsigned int code = utf8::decode(str.data() + pos, len);
+            utf8::encode(unicode::simple_casefold(code), res.m_ustring);
+            pos += len;
+        }
+    }
+
+    res.m_length = m_length;
+    return res;
+}
+
+/*
+    Already normalized text is copied as is: the quick check pass skips
+    ASCII runs a word at a time and decodes only the rest.
+*/
+UString UString::normalize_nfc() const {
+    UString res;
+    res.m_length = unicode::normalize(bytes(), unicode::normal_form::nfc, res.m_ustring);
+    return res;
+}
+
+UString UString::normalize_nfd() const {
+    UString res;
+    res.m_length = unicode::normalize(bytes(), unicode::normal_form::nfd, res.m_ustring);
+    return res;
+}
+
+bool UString::is_nfc() const {
+    return unicode::is_normalized(bytes(), unicode::normal_form::nfc);
+}
+
+bool UString::is_nfd() const {
+    return unicode::is_normalized(bytes(), unicode::normal_form::nfd);
+}
+
 UString::uchar UString::at(size_t index) const {
     if (index >= m_length) {
         throw std::out_of_range("index value is greater than the length of the string");
     }
+    USTRING_STAT_ADD(uchar_allocations, 1);
     size_t pos = get_codepoint_pos(index);
-    return m_ustring.substr(pos, get_codepoint_len(pos));
+    return bytes().substr(pos, get_codepoint_len(pos));
 }
 
 UString::uchar UString::operator[](size_t index) const {
+    USTRING_STAT_ADD(uchar_allocations, 1);
     size_t pos = get_codepoint_pos(index);
-    return m_ustring.substr(pos, get_codepoint_len(pos));
+    return bytes().substr(pos, get_codepoint_len(pos));
 }
 
 void UString::push_back(unsigned int ch) {
+    USTRING_STAT_ADD(uchar_allocations, 1);
     push_back(codepoint_to_string(ch));
 }
 
 void UString::push_back(uchar ch) {
+    USTRING_STAT_ADD(temporary_ustrings, 1);
     UString other = UString(ch);
     *this += other;
 }
@@ -275,8 +939,11 @@ void UString::pop_back() {
         throw std::length_error("cannot remove the last element from an empty string");
     }
 
-    size_t pos = get_codepoint_pos(m_length - 1);
-    m_ustring.erase(pos);
+    // Step back over continuation bytes instead of walking from the start.
+    size_t len = 0;
+    utf8::decode_back(bytes().data() + size(), len);
+    detach();
+    m_ustring.erase(m_ustring.size() - len);
     --m_length;
 }
 
@@ -312,16 +979,155 @@ UString::reverse_iterator UString::crend() const noexcept {
     return rend();
 }
 
+UString::grapheme_iterator UString::grapheme_begin() const {
+    return grapheme_iterator(bytes(), 0);
+}
+
+UString::grapheme_iterator UString::grapheme_end() const {
+    return grapheme_iterator(bytes(), size());
+}
+
+size_t UString::grapheme_count() const {
+    const ustring_t& str = bytes();
+    size_t count = 0;
+    for (size_t pos = 0; pos < str.size(); pos = unicode::next_grapheme_break(str, pos)) {
+        ++count;
+    }
+    return count;
+}
+
+void UString::pop_back_grapheme() {
+    if (m_length == 0) {
+        throw std::length_error("cannot remove the last element from an empty string");
+    }
+
+    size_t pos = unicode::prev_grapheme_break(bytes(), size());
+    size_t removed = 0;
+    for (size_t i = pos; i < size(); i += get_codepoint_len(i)) {
+        ++removed;
+    }
+    detach();
+    m_ustring.erase(pos);
+    m_length -= removed;
+}
+
+namespace {
+
+/*
+    A grapheme cluster is drawn as one glyph: its width is that of the
+    first codepoint with a nonzero width, so joined emoji sequences and
+    Hangul jamo take 2 columns rather than the sum over the cluster.
+    Flags (a regional indicator pair) and pictographs followed by the
+    emoji presentation selector U+FE0F are drawn as emoji, 2 columns wide.
+    Also counts the codepoints of the cluster [pos, next).
+*/
+size_t cluster_width(std::string_view str, size_t pos, size_t next, size_t& length) {
+    size_t width = 0;
+    unsigned int base = 0;
+    unsigned int second = 0;
+    length = 0;
+    for (size_t i = pos; i < next;) {
+        size_t len = 0;
+        unsigned int code = utf8::decode(str.data() + i, len);
+        if (width == 0) {
+            width = unicode::column_width(code);
+        }
+        if (length == 0) {
+            base = code;
+        } else if (length == 1) {
+            second = code;
+        }
+        ++length;
+        i += len;
+    }
+
+    if (length >= 2) {
+        unicode::grapheme_break prop = unicode::grapheme_break_of(base);
+        if (prop == unicode::grapheme_break::regional_indicator &&
+            unicode::grapheme_break_of(second) == unicode::grapheme_break::regional_indicator) {
+            return 2;
+        }
+        if (prop == unicode::grapheme_break::ext_pict && second == 0xFE0F) {
+            return 2;
+        }
+    }
+    return std::min<size_t>(width, 2);
+}
+
+}  // namespace
+
+size_t UString::display_width() const {
+    const ustring_t& str = bytes();
+    size_t width = 0;
+    size_t pos = 0;
+    while (pos < str.size()) {
+        // Every printable ASCII byte but the last one of a run is a cluster of width 1.
+        size_t run = utf8::printable_run(str.data() + pos, str.size() - pos);
+        if (run > 1) {
+            width += run - 1;
+            pos += run - 1;
+        }
+
+        size_t next = unicode::next_grapheme_break(str, pos);
+        size_t length = 0;
+        width += cluster_width(str, pos, next, length);
+        pos = next;
+    }
+    return width;
+}
+
+void UString::truncate_to_width(size_t width) {
+    /*
+        Cuts at grapheme cluster boundaries, so combining marks and joined
+        emoji sequences are never separated from their base character.
+    */
+    const ustring_t& str = bytes();
+    size_t used = 0;
+    size_t kept = 0;
+    size_t pos = 0;
+    while (pos < str.size()) {
+        // Every printable ASCII byte but the last one of a run is a cluster of width 1.
+        size_t run = utf8::printable_run(str.data() + pos, str.size() - pos);
+        if (run > 1) {
+            size_t take = std::min(run - 1, width - used);
+            used += take;
+            kept += take;
+            pos += take;
+            if (take < run - 1) {
+                break;
+            }
+        }
+
+        size_t next = unicode::next_grapheme_break(str, pos);
+        size_t cluster_length = 0;
+        size_t width_of_cluster = cluster_width(str, pos, next, cluster_length);
+        if (used + width_of_cluster > width) {
+            break;
+        }
+        used += width_of_cluster;
+        kept += cluster_length;
+        pos = next;
+    }
+
+    if (pos < str.size()) {
+        detach();
+        m_ustring.erase(pos);
+        m_length = kept;
+    }
+}
+
 UString operator+(const UString& lhs, const UString& rhs) {
-    return lhs + rhs.m_ustring;
+    UString res = lhs;
+    res += rhs;
+    return res;
 }
 
 UString operator+(const UString& lhs, const std::string& rhs) {
-    return UString(lhs.m_ustring + rhs);
+    return UString(lhs.bytes() + rhs);
 }
 
 UString operator+(const std::string& lhs, const UString& rhs) {
-    return UString(lhs + rhs.m_ustring);
+    return UString(lhs + rhs.bytes());
 }
 
 UString operator+(const UString& lhs, const char* rhs) {
@@ -333,7 +1139,13 @@ UString operator+(const char* lhs, const UString& rhs) {
 }
 
 bool operator==(const UString& lhs, const UString& rhs) noexcept {
-    return lhs.m_ustring == rhs.m_ustring;
+    if (lhs.m_is_shared && rhs.m_is_shared && lhs.m_shared == rhs.m_shared) {
+        return true;
+    }
+    if (lhs.is_interned() && rhs.is_interned()) {
+        return false;
+    }
+    return lhs.bytes() == rhs.bytes();
 }
 
 bool operator!=(const UString& lhs, const UString& rhs) noexcept {
@@ -341,23 +1153,79 @@ bool operator!=(const UString& lhs, const UString& rhs) noexcept {
 }
 
 bool operator<=(const UString& lhs, const UString& rhs) noexcept {
-    return lhs.m_ustring <= rhs.m_ustring;
+    return lhs.bytes() <= rhs.bytes();
 }
 
 bool operator>=(const UString& lhs, const UString& rhs) noexcept {
-    return lhs.m_ustring >= rhs.m_ustring;
+    return lhs.bytes() >= rhs.bytes();
 }
 
 bool operator<(const UString& lhs, const UString& rhs) noexcept {
-    return lhs.m_ustring < rhs.m_ustring;
+    return lhs.bytes() < rhs.bytes();
 }
 
 bool operator>(const UString& lhs, const UString& rhs) noexcept {
-    return lhs.m_ustring > rhs.m_ustring;
+    return lhs.bytes() > rhs.bytes();
+}
+
+namespace {
+
+unsigned int fold_code(unsigned int code) noexcept {
+    return code < 0x80 ? utf8::ascii_tolower(code) : unicode::simple_casefold(code);
+}
+
+}  // namespace
+
+bool iequals(const UString& lhs, const UString& rhs) noexcept {
+    if (lhs.m_is_shared && rhs.m_is_shared && lhs.m_shared == rhs.m_shared) {
+        return true;
+    }
+    return icompare(lhs, rhs) == 0;
+}
+
+int icompare(const UString& lhs, const UString& rhs) noexcept {
+    /*
+        Compares simple case folded codepoints on the fly, without building
+        folded copies. Eight-byte ASCII blocks are folded and compared in one
+        step; any mismatch is re-examined codepoint by codepoint.
+    */
+    std::string_view lbytes = lhs.bytes();
+    std::string_view rbytes = rhs.bytes();
+    size_t lpos = 0;
+    size_t rpos = 0;
+    while (lpos < lbytes.size() && rpos < rbytes.size()) {
+        if (lpos + 8 <= lbytes.size() && rpos + 8 <= rbytes.size()) {
+            uint64_t lword = utf8::load8(lbytes.data() + lpos);
+            uint64_t rword = utf8::load8(rbytes.data() + rpos);
+            if (utf8::is_ascii8(lword | rword) && utf8::ascii_tolower8(lword) == utf8::ascii_tolower8(rword)) {
+                lpos += 8;
+                rpos += 8;
+                continue;
+            }
+        }
+
+        size_t llen = 0;
+        size_t rlen = 0;
+        unsigned int lcode = fold_code(utf8::decode(lbytes.data() + lpos, llen));
+        unsigned int rcode = fold_code(utf8::decode(rbytes.data() + rpos, rlen));
+        if (lcode != rcode) {
+            return lcode < rcode ? -1 : 1;
+        }
+        lpos += llen;
+        rpos += rlen;
+    }
+
+    if (lpos < lbytes.size()) {
+        return 1;
+    }
+    if (rpos < rbytes.size()) {
+        return -1;
+    }
+    return 0;
 }
 
 std::ostream& operator<<(std::ostream& os, const UString& ustr) {
-    os << ustr.m_ustring;
+    os << ustr.bytes();
     return os;
 }
 
@@ -401,19 +1269,142 @@ std::string UString::codepoint_to_string(unsigned int code) {
     return bytes.data();
 }
 
+const UString::ustring_t& UString::bytes() const noexcept {
+    return m_is_shared ? m_shared->ustring : m_ustring;
+}
+
+void UString::detach() {
+    if (m_is_shared) {
+        USTRING_STAT_ADD(detach_copies, 1);
+        USTRING_STAT_ADD(detach_bytes, m_shared->ustring.size());
+        shared_rep* rep = m_shared;
+        ustring_t copy = rep->ustring;
+        new (&m_ustring) ustring_t(std::move(copy));
+        m_is_shared = 0;
+        rep->release();
+    }
+}
+
+// Ends the lifetime of the active union member.
+void UString::destroy() noexcept {
+    if (m_is_shared) {
+        m_shared->release();
+    } else {
+        m_ustring.~ustring_t();
+    }
+}
+
+// Takes over other's bytes into *this, which holds none; other is left empty.
+void UString::steal(UString& other) noexcept {
+    m_length = other.m_length;
+    m_is_shared = other.m_is_shared;
+    if (m_is_shared) {
+        m_shared = other.m_shared;
+        new (&other.m_ustring) ustring_t();
+        other.m_is_shared = 0;
+    } else {
+        new (&m_ustring) ustring_t(std::move(other.m_ustring));
+    }
+    other.m_length = 0;
+}
+
+// Replaces the bytes with the shared buffer, taking over one reference to it.
+void UString::adopt(shared_rep* rep) noexcept {
+    destroy();
+    m_shared = rep;
+    m_is_shared = 1;
+}
+
 size_t UString::get_codepoint_pos(size_t index) const {
-    return get_codepoint_pos(index, m_ustring);
+    return get_codepoint_pos(index, bytes());
 }
 
 size_t UString::get_codepoint_len(size_t pos) const {
-    return get_codepoint_len(pos, m_ustring);
+    return get_codepoint_len(pos, bytes());
+}
+
+void UString::init_length(bool parallel, size_t blocks) {
+    bool well = false;
+    if (parallel) {
+        size_t length = 0;
+        well = scan_parallel(m_ustring, blocks, length);
+        m_length = length;
+    } else {
+        well = is_well(m_ustring);
+        m_length = well ? calc_length(m_ustring) : 0;
+    }
+    if (!well) {
+        throw std::invalid_argument("invalid UTF-8 string");
+    }
+}
+
+bool UString::scan_parallel(std::string_view str, size_t blocks, size_t& length) {
+    /*
+        Splits the bytes into blocks and moves every split point forward past
+        at most three continuation bytes to the next lead byte, so each
+        sequence, including one straddling a split point, is validated whole
+        by exactly one block. A longer run of continuation bytes cannot be
+        well-formed anywhere.
+    */
+    constexpr size_t min_block_size = 1 << 20;
+
+    thread_pool& pool = thread_pool::instance();
+    if (blocks == 0) {
+        blocks = std::max<size_t>(1, std::min(pool.concurrency(), str.size() / min_block_size));
+    }
+    blocks = std::max<size_t>(1, std::min(blocks, str.size()));
+
+    auto is_continuation = [&str](size_t pos) {
+        return (static_cast<unsigned char>(str[pos]) & 0xC0) == 0x80;
+    };
+
+    std::vector<size_t> bounds(blocks + 1, str.size());
+    bounds[0] = 0;
+    for (size_t i = 1; i < blocks; ++i) {
+        size_t pos = std::max(bounds[i - 1], str.size() / blocks * i);
+        for (size_t skipped = 0; pos < str.size() && is_continuation(pos); ++skipped, ++pos) {
+            if (skipped == 3) {
+                return false;
+            }
+        }
+        bounds[i] = pos;
+    }
+
+    struct block_result {
+        bool well = true;
+        size_t length = 0;
+    };
+    std::vector<block_result> results(blocks);
+    pool.parallel_for(blocks, [&](size_t i) {
+        std::string_view block = str.substr(bounds[i], bounds[i + 1] - bounds[i]);
+        results[i].well = is_well(block);
+        results[i].length = results[i].well ? calc_length(block) : 0;
+    });
+
+    // Pairwise tree reduction of the per-block results.
+    for (size_t step = 1; step < blocks; step *= 2) {
+        for (size_t i = 0; i + step < blocks; i += 2 * step) {
+            results[i].well = results[i].well && results[i + step].well;
+            results[i].length += results[i + step].length;
+        }
+    }
+
+    length = results[0].length;
+    return results[0].well;
 }
 
 size_t UString::calc_length() const {
+    return calc_length(bytes());
+}
+
+size_t UString::calc_length(std::string_view str) {
+    USTRING_STAT_ADD(length_scans, 1);
+    USTRING_STAT_ADD(scanned_bytes, str.size());
+
     size_t pos = 0;
     size_t len = 0;
-    while (pos < m_ustring.size()) {
-        pos += get_codepoint_len(pos);
+    while (pos < str.size()) {
+        pos += utf8::sequence_len(static_cast<unsigned char>(str[pos]));
         ++len;
     }
     return len;
@@ -1,7 +1,19 @@
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <string_view>
 #include <iostream>
+#include <vector>
+
+#include "hash.hpp"
+#include "stats.hpp"
+
+enum class Charset {
+    Latin1,     // ISO-8859-1
+    Cp1251,     // Windows-1251
+    Koi8r,      // KOI8-R
+};
 
 class UString {
     using ustring_t = std::string;
@@ -44,41 +56,136 @@ private:
         iterator operator-(size_t n) const;
 
     private:
-        ustring_t m_ustring;
+        const ustring_t* m_ustring = nullptr;
         size_t m_idx = 0;
         size_t m_length = 0;
     };
 
+    struct grapheme_iterator {
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type   = std::ptrdiff_t;
+        using value_type        = std::string_view;
+        using pointer           = void*;
+        using reference         = std::string_view;
+
+    public:
+        grapheme_iterator(const ustring_t& ustring, size_t pos);
+
+        reference operator*() const;
+
+        grapheme_iterator& operator++();
+        grapheme_iterator operator++(int);
+        grapheme_iterator& operator--();
+        grapheme_iterator operator--(int);
+
+        bool operator==(const grapheme_iterator& it) const;
+        bool operator!=(const grapheme_iterator& it) const;
+
+    private:
+        const ustring_t* m_ustring = nullptr;
+        size_t m_pos = 0;
+        size_t m_next = 0;
+    };
+
 public:
     using const_iterator = iterator;
     using reverse_iterator = std::reverse_iterator<iterator>;
     using const_reverse_iterator = reverse_iterator;
 
+    /*
+        Tag selecting block-parallel validation and length counting. blocks
+        is the number of blocks to split the bytes into, 0 picks it from the
+        size and the number of threads in the pool.
+    */
+    struct parallel_policy {
+        size_t blocks = 0;
+    };
+
+    // Constructing from a std::string at least this large goes parallel automatically.
+    static constexpr size_t parallel_threshold = 4 << 20;
+
+    /*
+        Options of the binary format written by serialize(). checkpoint_interval
+        stores the byte offset of every checkpoint_interval-th codepoint, which
+        lets serialized_at() index into a blob without decoding it from the
+        start; 0 disables checkpoints.
+    */
+    struct serialize_options {
+        bool checksum = true;
+        size_t checkpoint_interval = 0;
+    };
+
 public:
-    UString() = default;
+    UString() noexcept;
 
     UString(const char* cstr);
     UString(const std::string& str);
+    UString(std::string&& str);
+    UString(std::string&& str, parallel_policy policy);
     UString(const UString& other);
     UString(UString&& other) noexcept;
 
     UString& operator=(const char* str);
     UString& operator=(const std::string& str);
+    UString& operator=(std::string&& str);
     UString& operator=(const UString& other);
     UString& operator=(UString&& other) noexcept;
 
+    ~UString();
+
     UString& operator+=(const std::string& str);
     UString& operator+=(const char* cstr);
     UString& operator+=(const UString& other);
 
+    // Appends bytes known to be well-formed UTF-8 holding length codepoints; neither is checked.
+    UString& append_trusted(std::string_view str, size_t length);
+
     void clear() noexcept;
     bool empty() const noexcept;
 
     bool is_well() const;
+    static bool is_well(std::string_view str);
+
+    UString& share();
+    UString intern() const;
+
+    bool is_shared() const noexcept;
+    bool is_interned() const noexcept;
+
+    /*
+        Frees the pooled strings that no UString refers to any more and
+        returns their number. Until this is called, interned strings stay in
+        the pool for the lifetime of the process.
+    */
+    static size_t purge_interned();
+
+    static ustring_stats stats();
+
+    void serialize(std::string& out) const;
+    void serialize(std::string& out, serialize_options options) const;
+    static UString deserialize(std::string_view blob, bool trusted = false);
+    static uchar serialized_at(std::string_view blob, size_t index);
+
+    static void serialize_batch(const std::vector<UString>& ustrs, std::string& out);
+    static void serialize_batch(const std::vector<UString>& ustrs, std::string& out,
+                                serialize_options options);
+    static std::vector<UString> deserialize_batch(std::string_view blob, bool trusted = false);
 
     size_t size() const noexcept;
     size_t length() const noexcept;
 
+    std::string_view view() const noexcept;
+
+    UString casefold() const;
+
+    UString normalize_nfc() const;
+    UString normalize_nfd() const;
+    bool is_nfc() const;
+    bool is_nfd() const;
+
+    static UString from_charset(std::string_view bytes, Charset charset);
+    std::string to_charset(Charset charset) const;
+
     uchar at(size_t index) const;
     uchar operator[](size_t index) const;
 
@@ -98,6 +205,15 @@ public:
     reverse_iterator rend() const noexcept;
     reverse_iterator crend() const noexcept;
 
+    grapheme_iterator grapheme_begin() const;
+    grapheme_iterator grapheme_end() const;
+
+    size_t grapheme_count() const;
+    void pop_back_grapheme();
+
+    size_t display_width() const;
+    void truncate_to_width(size_t width);
+
     friend UString operator+(const UString& lhs, const UString& rhs);
     friend UString operator+(const UString& lhs, const std::string& rhs);
     friend UString operator+(const std::string& lhs, const UString& rhs);
@@ -111,10 +227,34 @@ public:
     friend bool operator<(const UString& lhs, const UString& rhs) noexcept;
     friend bool operator>(const UString& lhs, const UString& rhs) noexcept;
 
+    friend bool iequals(const UString& lhs, const UString& rhs) noexcept;
+    friend int icompare(const UString& lhs, const UString& rhs) noexcept;
+
     friend std::ostream& operator<<(std::ostream& os, const UString& ustr);
     friend std::istream& operator>>(std::istream& is, UString& ustr);
 
 private:
+    /*
+        Immutable buffer shared between copies. The reference count is kept
+        in the buffer itself and is updated atomically, so shared strings may
+        be copied and read from different threads.
+    */
+    struct shared_rep {
+        ustring_t ustring;
+        bool interned = false;
+        std::atomic<size_t> refs{1};
+
+        void acquire() noexcept;
+        void release() noexcept;
+    };
+
+    const ustring_t& bytes() const noexcept;
+    void detach();
+
+    void destroy() noexcept;
+    void steal(UString& other) noexcept;
+    void adopt(shared_rep* rep) noexcept;
+
     std::string codepoint_to_string(unsigned int code);
 
     size_t get_codepoint_pos(size_t index) const;
@@ -122,8 +262,14 @@ private:
 
     size_t calc_length() const;
 
+    static size_t calc_length(std::string_view str);
+    static bool scan_parallel(std::string_view str, size_t blocks, size_t& length);
+
+    void init_length(bool parallel, size_t blocks);
+
 private:
-    static size_t get_codepoint_pos(size_t index, ustring_t ustring) {
+    static size_t get_codepoint_pos(size_t index, const ustring_t& ustring) {
+        USTRING_STAT_INDEX_WALK(index);
         size_t pos = 0;
         size_t usize = ustring.size();
         for (size_t i = 0; pos < usize && i < index; ++i) {
@@ -132,7 +278,7 @@ private:
         return pos;
     }
 
-    static size_t get_codepoint_len(size_t pos, ustring_t ustring) {
+    static size_t get_codepoint_len(size_t pos, const ustring_t& ustring) {
         unsigned char byte = ustring[pos];
         if ((0xF8 & byte) == 0xF0) {
             return 4;
@@ -147,6 +293,30 @@ private:
     }
 
 private:
-    ustring_t m_ustring;
-    size_t m_length = 0;
+    /*
+        Either the own bytes or a pointer to the shared buffer, so a string
+        that never opts into sharing costs no more than std::string and its
+        length. The tag takes the top bit of the length.
+    */
+    union {
+        ustring_t m_ustring;
+        shared_rep* m_shared;
+    };
+    size_t m_length : 63;
+    size_t m_is_shared : 1;
 };
+
+bool iequals(const UString& lhs, const UString& rhs) noexcept;
+int icompare(const UString& lhs, const UString& rhs) noexcept;
+
+namespace std {
+
+template <>
+struct hash<UString> {
+    size_t operator()(const UString& ustr) const noexcept {
+        std::string_view bytes = ustr.view();
+        return ustring_hash_bytes(bytes.data(), bytes.size());
+    }
+};
+
+}  // namespace std
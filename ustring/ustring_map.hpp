@@ -0,0 +1,241 @@
+#pragma once
+
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ustring.hpp"
+
+/*
+    Open-addressing hash table with UString keys.
+
+    Linear probing over a power-of-two array of stored hashes: a probe
+    touches only the packed hash array until a hash matches, and only then
+    compares key bytes. Hash 0 marks an empty slot. Erase uses backward
+    shifting, so there are no tombstones.
+
+    Lookups accept anything convertible to std::string_view (std::string,
+    const char*, ...) directly, without constructing (and validating) a
+    UString.
+*/
+template <typename T>
+class UStringMap {
+public:
+    UStringMap() = default;
+
+    size_t size() const noexcept {
+        return m_size;
+    }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    void clear() noexcept {
+        m_hashes.assign(m_hashes.size(), 0);
+        for (auto& slot : m_entries) {
+            slot.reset();
+        }
+        m_size = 0;
+    }
+
+    void reserve(size_t n) {
+        size_t capacity = min_capacity;
+        while (capacity * max_load_num < n * max_load_den) {
+            capacity *= 2;
+        }
+        if (capacity > m_hashes.size()) {
+            rehash(capacity);
+        }
+    }
+
+    template <typename... Args>
+    std::pair<T*, bool> try_emplace(UString key, Args&&... args) {
+        std::string_view bytes = key.view();
+        uint64_t hash = slot_hash(bytes);
+        size_t idx = lookup(bytes, hash);
+        if (idx != npos) {
+            return { &m_entries[idx]->value, false };
+        }
+
+        reserve(m_size + 1);
+        idx = hash & (m_hashes.size() - 1);
+        while (m_hashes[idx] != 0) {
+            idx = (idx + 1) & (m_hashes.size() - 1);
+        }
+        m_hashes[idx] = hash;
+        m_entries[idx].emplace(entry{ std::move(key), T(std::forward<Args>(args)...) });
+        ++m_size;
+        return { &m_entries[idx]->value, true };
+    }
+
+    T& operator[](UString key) {
+        return *try_emplace(std::move(key)).first;
+    }
+
+    template <typename K>
+    T* find(const K& key) {
+        std::string_view bytes = key_view(key);
+        size_t idx = lookup(bytes, slot_hash(bytes));
+        return idx == npos ? nullptr : &m_entries[idx]->value;
+    }
+
+    template <typename K>
+    const T* find(const K& key) const {
+        std::string_view bytes = key_view(key);
+        size_t idx = lookup(bytes, slot_hash(bytes));
+        return idx == npos ? nullptr : &m_entries[idx]->value;
+    }
+
+    template <typename K>
+    bool contains(const K& key) const {
+        return find(key) != nullptr;
+    }
+
+    template <typename K>
+    bool erase(const K& key) {
+        std::string_view bytes = key_view(key);
+        size_t idx = lookup(bytes, slot_hash(bytes));
+        if (idx == npos) {
+            return false;
+        }
+
+        size_t mask = m_hashes.size() - 1;
+        size_t hole = idx;
+        size_t next = idx;
+        while (true) {
+            next = (next + 1) & mask;
+            if (m_hashes[next] == 0) {
+                break;
+            }
+            size_t home = m_hashes[next] & mask;
+            bool movable = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+            if (movable) {
+                m_hashes[hole] = m_hashes[next];
+                m_entries[hole] = std::move(m_entries[next]);
+                hole = next;
+            }
+        }
+        m_hashes[hole] = 0;
+        m_entries[hole].reset();
+        --m_size;
+        return true;
+    }
+
+    template <typename F>
+    void for_each(F&& func) const {
+        for (size_t i = 0; i < m_hashes.size(); ++i) {
+            if (m_hashes[i] != 0) {
+                func(m_entries[i]->key, m_entries[i]->value);
+            }
+        }
+    }
+
+private:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    static constexpr size_t min_capacity = 16;
+    static constexpr size_t max_load_num = 3;
+    static constexpr size_t max_load_den = 4;
+
+    struct entry {
+        UString key;
+        T value;
+    };
+
+    template <typename K>
+    static std::string_view key_view(const K& key) {
+        if constexpr (std::is_same_v<K, UString>) {
+            return key.view();
+        } else {
+            return std::string_view(key);
+        }
+    }
+
+    static uint64_t slot_hash(std::string_view bytes) noexcept {
+        uint64_t hash = ustring_hash_bytes(bytes.data(), bytes.size());
+        return hash != 0 ? hash : 1;
+    }
+
+    size_t lookup(std::string_view key, uint64_t hash) const {
+        if (m_hashes.empty()) {
+            return npos;
+        }
+        size_t mask = m_hashes.size() - 1;
+        for (size_t idx = hash & mask; m_hashes[idx] != 0; idx = (idx + 1) & mask) {
+            if (m_hashes[idx] == hash && m_entries[idx]->key.view() == key) {
+                return idx;
+            }
+        }
+        return npos;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<uint64_t> hashes(capacity, 0);
+        std::vector<std::optional<entry>> entries(capacity);
+        size_t mask = capacity - 1;
+        for (size_t i = 0; i < m_hashes.size(); ++i) {
+            if (m_hashes[i] == 0) {
+                continue;
+            }
+            size_t idx = m_hashes[i] & mask;
+            while (hashes[idx] != 0) {
+                idx = (idx + 1) & mask;
+            }
+            hashes[idx] = m_hashes[i];
+            entries[idx] = std::move(m_entries[i]);
+        }
+        m_hashes = std::move(hashes);
+        m_entries = std::move(entries);
+    }
+
+private:
+    std::vector<uint64_t> m_hashes;
+    std::vector<std::optional<entry>> m_entries;
+    size_t m_size = 0;
+};
+
+class UStringSet {
+public:
+    UStringSet() = default;
+
+    size_t size() const noexcept {
+        return m_map.size();
+    }
+
+    bool empty() const noexcept {
+        return m_map.empty();
+    }
+
+    void clear() noexcept {
+        m_map.clear();
+    }
+
+    void reserve(size_t n) {
+        m_map.reserve(n);
+    }
+
+    bool insert(UString key) {
+        return m_map.try_emplace(std::move(key)).second;
+    }
+
+    template <typename K>
+    bool contains(const K& key) const {
+        return m_map.contains(key);
+    }
+
+    template <typename K>
+    bool erase(const K& key) {
+        return m_map.erase(key);
+    }
+
+    template <typename F>
+    void for_each(F&& func) const {
+        m_map.for_each([&func](const UString& key, const empty_t&) { func(key); });
+    }
+
+private:
+    struct empty_t {};
+
+    UStringMap<empty_t> m_map;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+/*
+    Low-level helpers over well-formed UTF-8 bytes.
+
+    ASCII runs are processed eight bytes at a time inside a 64-bit register
+    (SWAR), which keeps the fast paths portable across architectures.
+*/
+
+namespace utf8 {
+
+constexpr uint64_t high_bits = 0x8080808080808080ull;
+
+inline uint64_t broadcast(unsigned char byte) noexcept {
+    return 0x0101010101010101ull * byte;
+}
+
+inline uint64_t load8(const char* p) noexcept {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    return word;
+}
+
+inline void store8(char* p, uint64_t word) noexcept {
+    std::memcpy(p, &word, 8);
+}
+
+inline bool is_ascii8(uint64_t word) noexcept {
+    return (word & high_bits) == 0;
+}
+
+// Length of the ASCII prefix of [p, p + size).
+inline size_t ascii_run(const char* p, size_t size) noexcept {
+    size_t pos = 0;
+    while (pos + 8 <= size && is_ascii8(load8(p + pos))) {
+        pos += 8;
+    }
+    while (pos < size && (static_cast<unsigned char>(p[pos]) & 0x80) == 0) {
+        ++pos;
+    }
+    return pos;
+}
+
+// True if all eight bytes are printable ASCII (0x20..0x7E).
+inline bool is_printable8(uint64_t word) noexcept {
+    uint64_t below_space = (word - broadcast(0x20)) & ~word;
+    uint64_t del = word ^ broadcast(0x7F);
+    uint64_t is_del = (del - broadcast(0x01)) & ~del;
+    return ((word | below_space | is_del) & high_bits) == 0;
+}
+
+// Length of the printable ASCII prefix of [p, p + size).
+inline size_t printable_run(const char* p, size_t size) noexcept {
+    size_t pos = 0;
+    while (pos + 8 <= size && is_printable8(load8(p + pos))) {
+        pos += 8;
+    }
+    while (pos < size && p[pos] >= 0x20 && p[pos] < 0x7F) {
+        ++pos;
+    }
+    return pos;
+}
+
+// Lowercases eight ASCII bytes at once. Every byte must be < 0x80.
+inline uint64_t ascii_tolower8(uint64_t word) noexcept {
+    uint64_t above_z = word + broadcast(0x7F - 'Z');
+    uint64_t from_a = word + broadcast(0x80 - 'A');
+    uint64_t upper = (from_a ^ above_z) & high_bits;
+    return word | (upper >> 2);
+}
+
+inline unsigned int ascii_tolower(unsigned int code) noexcept {
+    return code - 'A' < 26 ? code + ('a' - 'A') : code;
+}
+
+inline size_t sequence_len(unsigned char lead) noexcept {
+    if ((0xF8 & lead) == 0xF0) {
+        return 4;
+    }
+    if ((0xF0 & lead) == 0xE0) {
+        return 3;
+    }
+    if ((0xE0 & lead) == 0xC0) {
+        return 2;
+    }
+    return 1;
+}
+
+// Decodes the codepoint starting at p and stores its byte length in len.
+inline unsigned int decode(const char* p, size_t& len) noexcept {
+    auto bytes = reinterpret_cast<const unsigned char*>(p);
+    len = sequence_len(bytes[0]);
+    switch (len) {
+        case 4:
+            return ((bytes[0] & 0x07u) << 18) | ((bytes[1] & 0x3Fu) << 12) |
+                   ((bytes[2] & 0x3Fu) << 6) | (bytes[3] & 0x3Fu);
+        case 3:
+            return ((bytes[0] & 0x0Fu) << 12) | ((bytes[1] & 0x3Fu) << 6) | (bytes[2] & 0x3Fu);
+        case 2:
+            return ((bytes[0] & 0x1Fu) << 6) | (bytes[1] & 0x3Fu);
+        default:
+            return bytes[0];
+    }
+}
+
+// Decodes the codepoint that ends right before p, stores its byte length in len.
+inline unsigned int decode_back(const char* p, size_t& len) noexcept {
+    const char* start = p - 1;
+    while ((static_cast<unsigned char>(*start) & 0xC0) == 0x80) {
+        --start;
+    }
+    return decode(start, len);
+}
+
+inline void encode(unsigned int code, std::string& out) {
+    if (code <= 0x7F) {
+        out.push_back(static_cast<char>(code));
+    } else if (code <= 0x7FF) {
+        out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else if (code <= 0xFFFF) {
+        out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+}
+
+}  // namespace utf8